@@ -19,9 +19,11 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "trace.h"
 
 struct {
   struct spinlock lock;
@@ -96,8 +98,13 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
+    trace(TR_BREAD, blockno, dev);
+    if(myproc())
+      myproc()->nrblock++;
     virtio_disk_rw(b, 0);
     b->valid = 1;
+  } else {
+    trace(TR_BREADHIT, blockno, dev);
   }
   return b;
 }
@@ -108,6 +115,9 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
+  trace(TR_BWRITE, b->blockno, b->dev);
+  if(myproc())
+    myproc()->nwblock++;
   virtio_disk_rw(b, 1);
 }
 
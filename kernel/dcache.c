@@ -0,0 +1,141 @@
+// Directory name-lookup cache.
+//
+// Remembers the result of recent dirlookup()s, keyed by the
+// directory's (dev, inum) and the name looked up, so that a
+// repeated lookup needn't read the directory again. An entry
+// with inum 0 records that the directory has no such name.
+//
+// Callers hold the directory's sleep-lock, at least shared,
+// and dirlink(), unlink and the freeing of a directory update
+// the cache holding that lock exclusively, so an entry is
+// never stale while someone can see it.
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dir;            // inum of the directory
+  char name[DIRSIZ];
+  uint inum;           // 0 if name isn't in dir
+  uint off;            // byte offset of the entry in dir
+  struct dentry *next; // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDENTRY];
+  struct dentry *hash[NDHASH];
+  int hand;            // next entry to recycle
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+bucket(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Remove e from its hash chain.
+static void
+unhash(struct dentry *e)
+{
+  struct dentry **pp;
+
+  for(pp = bucket(e->dev, e->dir, e->name); *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  e->dev = 0;
+  e->dir = 0;
+}
+
+static struct dentry*
+find(struct dentry **b, struct inode *dp, char *name)
+{
+  struct dentry *e;
+
+  for(e = *b; e; e = e->next)
+    if(e->dev == dp->dev && e->dir == dp->inum && namecmp(name, e->name) == 0)
+      return e;
+  return 0;
+}
+
+// Look for name in directory dp.
+// Returns 1 and sets *inum and *off if the cache knows,
+// with *inum == 0 if dp has no entry called name.
+// Returns 0 if dp has to be searched.
+int
+dcache_lookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  if((e = find(bucket(dp->dev, dp->inum, name), dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = e->inum;
+  *off = e->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in dp is inum at offset off,
+// or, if inum is 0, that dp has no such name.
+void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry **b, *e;
+
+  acquire(&dcache.lock);
+  b = bucket(dp->dev, dp->inum, name);
+  if((e = find(b, dp, name)) == 0){
+    e = &dcache.ent[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDENTRY;
+    if(e->dir)
+      unhash(e);
+    e->dev = dp->dev;
+    e->dir = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    e->next = *b;
+    *b = e;
+  }
+  e->inum = inum;
+  e->off = off;
+  release(&dcache.lock);
+}
+
+// Forget everything about directory dp, which is being freed.
+void
+dcache_purge(struct inode *dp)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent; e < &dcache.ent[NDENTRY]; e++)
+    if(e->dir && e->dev == dp->dev && e->dir == dp->inum)
+      unhash(e);
+  release(&dcache.lock);
+}
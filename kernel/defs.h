@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -25,25 +26,43 @@ void            consputc(int);
 // exec.c
 int             exec(char*, char**);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(struct inode*, char*, uint*, uint*);
+void            dcache_enter(struct inode*, char*, uint, uint);
+void            dcache_purge(struct inode*);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
 int             filestat(struct file*, uint64 addr);
+int             filegetdents(struct file*, uint64, int);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filesplice(struct file*, struct file*, int n);
+struct file*    fdget(struct proc*, int);
+int             fdinstall(struct proc*, struct file*);
+void            fdclear(struct proc*, int);
+int             fdfork(struct proc*, struct proc*);
+void            fdcloseall(struct proc*);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirread(struct inode*, int, uint64, uint*, int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -52,6 +71,7 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+struct buf*     ibread(struct inode*, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -61,35 +81,55 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kzalloc(void);
+int             kdup(void *);
+int             kshared(void *);
+void            kzerofill(void);
 void            kfree(void *);
+void*           superalloc(void);
+void            superfree(void *);
 void            kinit(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_freed(uint);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+void            end_opn(int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipeput(struct pipe*, char*, int);
+int             pipewaitroom(struct pipe*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// prof.c
+void            profinit(void);
+void            profile(int);
+int             proftick(void);
+int             profread(uint64, int);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
+uint64          proc_satp(struct proc*);
 int             kill(int);
+int             setaffinity(int, uint64);
+int             getaffinity(int, uint64*);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -106,6 +146,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             procstat(uint64, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -117,13 +158,25 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             lockclass(char*, int);
+int             lockcount(int);
+uint64          lockacquired(int, int, uint64);
+void            lockheld(int, uint64);
+int             getlockstats(uint64, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
+int             holdingsleep_shared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// lockbench.c
+void            lockbenchinit(void);
+int             lockbench(int, int);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -140,6 +193,8 @@ void            argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+int             syscount(int);
+int             getsysstats(uint64, int);
 
 // trap.c
 extern uint     ticks;
@@ -148,6 +203,10 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// trace.c
+void            traceinit(void);
+void            trace(int, uint, uint);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -158,6 +217,10 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(void);
+int             kvmshare(pagetable_t, uint64);
+int             kvmstack(uint64);
+void            kvmunshare(pagetable_t, uint64);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -168,6 +231,9 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmsplit(pagetable_t, uint64);
+uint64          uvmloan(pagetable_t, uint64);
+int             uvmunloan(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
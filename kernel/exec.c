@@ -37,7 +37,7 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -68,7 +68,8 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  iunlock_shared(ip);
+  iput(ip);
   end_op();
   ip = 0;
 
@@ -126,15 +127,24 @@ exec(char *path, char **argv)
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+
+  // switch to the new page table, which maps this kernel stack
+  // too, before freeing the old one. a fresh ASID keeps TLB
+  // entries from the old page table from being used.
+  p->asidgen = 0;
+  push_off();
+  w_satp(proc_satp(p));
+  pop_off();
+  proc_freepagetable(oldpagetable, oldsz, p->kstack);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(pagetable, sz, p->kstack);
   if(ip){
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     end_op();
   }
   return -1;
@@ -3,3 +3,11 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// a buffer for readv() and writev().
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
+
+#define IOV_MAX   16  // most buffers per readv() or writev()
@@ -12,35 +12,63 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "buf.h"
+#include "fcntl.h"
+
+// a write reserves WRITEBLOCKS blocks of the log, and writes
+// up to MAXWRITE bytes per transaction: room for its data plus
+// the i-node, an indirect block, two bitmap blocks, and a
+// block of slop for a non-aligned start. half the log leaves
+// room for other FS system calls to proceed alongside.
+#define WRITEBLOCKS (LOGSIZE/2)
+#define MAXWRITE ((WRITEBLOCKS-1-1-2-1) * BSIZE)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
+  struct file *free;   // files with ref 0
   struct file file[NFILE];
 } ftable;
 
+// Add n files at f to the free list.
+// Caller must hold ftable.lock.
+static void
+fgrow(struct file *f, int n)
+{
+  for(; n > 0; n--, f++){
+    memset(f, 0, sizeof(*f));
+    f->next = ftable.free;
+    ftable.free = f;
+  }
+}
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  acquire(&ftable.lock);
+  fgrow(ftable.file, NFILE);
+  release(&ftable.lock);
 }
 
-// Allocate a file structure.
+// Allocate a file structure, growing the table
+// by a page of them if all are in use.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.free == 0 && (f = (struct file*)kalloc()) != 0)
+    fgrow(f, PGSIZE / sizeof(*f));
+  if((f = ftable.free) != 0){
+    ftable.free = f->next;
+    f->ref = 1;
   }
   release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -71,6 +99,8 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  f->next = ftable.free;
+  ftable.free = f;
   release(&ftable.lock);
 
   if(ff.type == FD_PIPE){
@@ -82,6 +112,131 @@ fileclose(struct file *f)
   }
 }
 
+// Per-process file descriptor tables. The first NOFILE
+// fds are in p->ofile, the rest in pages allocated as they
+// are needed. p->fdmap has a bit set for each fd in use, and
+// p->fdfull one for each fdmap word with every bit set, so the
+// lowest free fd takes two lookups to find. Only p itself
+// (or its parent, during fork) uses p's table, so no locks.
+
+// Index of the lowest set bit in x, which must not be 0.
+static int
+lowbit(uint64 x)
+{
+  static const char pos[64] = {
+     0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6,
+  };
+
+  return pos[((x & -x) * 0x03f79d71b4cb0a89UL) >> 58];
+}
+
+// Return the address of fd's slot in p's table, allocating
+// its page if alloc is set. Returns 0 if there is none.
+static struct file**
+fdslot(struct proc *p, int fd, int alloc)
+{
+  struct file ***pg;
+
+  if(fd < NOFILE)
+    return &p->ofile[fd];
+  fd -= NOFILE;
+  pg = &p->ofilepg[fd / FDPERPG];
+  if(*pg == 0){
+    if(!alloc || (*pg = (struct file**)kalloc()) == 0)
+      return 0;
+    memset(*pg, 0, PGSIZE);
+  }
+  return &(*pg)[fd % FDPERPG];
+}
+
+// Return the file open as fd in p, or 0.
+struct file*
+fdget(struct proc *p, int fd)
+{
+  if(fd < 0 || fd >= MAXOFILE || (p->fdmap[fd/64] & (1UL << (fd%64))) == 0)
+    return 0;
+  return *fdslot(p, fd, 0);
+}
+
+// Give f the lowest free fd in p. Takes over the caller's
+// reference to f on success. Returns the fd, or -1.
+int
+fdinstall(struct proc *p, struct file *f)
+{
+  struct file **slot;
+  int w, fd;
+
+  if(p->fdfull == ~0UL)
+    return -1;
+  w = lowbit(~p->fdfull);
+  fd = w*64 + lowbit(~p->fdmap[w]);
+  if(fd >= MAXOFILE || (slot = fdslot(p, fd, 1)) == 0)
+    return -1;
+  *slot = f;
+  p->fdmap[w] |= 1UL << (fd%64);
+  if(p->fdmap[w] == ~0UL)
+    p->fdfull |= 1UL << w;
+  return fd;
+}
+
+// Free fd in p. Leaves the file for the caller to close.
+void
+fdclear(struct proc *p, int fd)
+{
+  *fdslot(p, fd, 0) = 0;
+  p->fdmap[fd/64] &= ~(1UL << (fd%64));
+  p->fdfull &= ~(1UL << (fd/64));
+}
+
+// Give np, a new child of p, the same open files as p.
+// Returns 0, or -1 if out of memory.
+int
+fdfork(struct proc *np, struct proc *p)
+{
+  struct file **slot;
+  uint64 bits;
+  int w, fd;
+
+  for(w = 0; w < MAXOFILE/64; w++){
+    for(bits = p->fdmap[w]; bits; bits &= bits - 1){
+      fd = w*64 + lowbit(bits);
+      if((slot = fdslot(np, fd, 1)) == 0)
+        return -1;
+      *slot = filedup(fdget(p, fd));
+      np->fdmap[w] |= 1UL << (fd%64);
+    }
+  }
+  np->fdfull = p->fdfull;
+  return 0;
+}
+
+// Close all of p's open files and free its table's pages.
+void
+fdcloseall(struct proc *p)
+{
+  uint64 bits;
+  int w, fd;
+
+  for(w = 0; w < MAXOFILE/64; w++){
+    for(bits = p->fdmap[w]; bits; bits &= bits - 1){
+      fd = w*64 + lowbit(bits);
+      fileclose(fdget(p, fd));
+      *fdslot(p, fd, 0) = 0;
+    }
+    p->fdmap[w] = 0;
+  }
+  p->fdfull = 0;
+  for(w = 0; w < NOFILEPG; w++){
+    if(p->ofilepg[w]){
+      kfree(p->ofilepg[w]);
+      p->ofilepg[w] = 0;
+    }
+  }
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -91,9 +246,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilock_shared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlock_shared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -101,32 +256,110 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read up to n in-use entries of directory f into addr,
+// a user virtual address, as an array of struct dirent.
+// Returns the number read, 0 at the end, or -1.
+int
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  int r = -1;
+
+  if(f->type != FD_INODE || f->readable == 0 || n < 0)
+    return -1;
+  ilock(f->ip);
+  if(f->ip->type == T_DIR)
+    r = dirread(f->ip, 1, addr, &f->off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Whether other processes may share f, and so f->off.
+// Reads f->ref without ftable.lock, which is safe: if it is 1,
+// only the caller holds f, and only a holder can add a
+// reference, so it stays 1 for the whole system call. If it
+// is more, it may drop to 1 meanwhile, which only costs an
+// exclusive lock that wasn't needed.
+static int
+fileshared(struct file *f)
+{
+  return *(volatile int *)&f->ref > 1;
+}
+
+// Read from file f into the cnt buffers of iov in turn, which
+// hold user virtual addresses. Read at offset off, or, if off
+// is -1, at f->off and advance it. An inode is locked once for
+// the whole vector. Stops at the first buffer that isn't filled.
+// Returns the number of bytes read, or -1.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r = 0, tot = 0, excl;
+  uint pos;
 
   if(f->readable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+  if(f->type == FD_INODE){
+    // readers share the inode's lock, unless they'll move
+    // an f->off that another process can move too.
+    excl = off < 0 && fileshared(f);
+    if(excl)
+      ilock(f->ip);
+    else
+      ilock_shared(f->ip);
+    pos = off < 0 ? f->off : off;
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, pos, iov[i].iov_len)) < 0)
+        break;
+      pos += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    if(off < 0)
+      f->off = pos;
+    if(excl)
+      iunlock(f->ip);
+    else
+      iunlock_shared(f->ip);
+  } else if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].read))
       return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if(f->type == FD_PIPE)
+        r = piperead(f->pipe, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else
+        r = devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        break;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
   } else {
     panic("fileread");
   }
 
-  return r;
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
 }
 
 // Write to file f.
@@ -134,49 +367,257 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Write the cnt buffers of iov, which hold user virtual addresses,
+// to file f at offset off, or, if off is -1, at f->off and advance
+// it. Buffers share log transactions of up to MAXWRITE bytes, so a
+// small vector costs one begin_op() and one ilock().
+// Returns the number of bytes written, or -1 if they weren't all.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, m, room, tot = 0;
+  uint64 done;
+  uint pos;
 
   if(f->writable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    for(i = 0; i < cnt; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else
+        r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
+    i = 0;
+    done = 0;
+    r = m = 0;
+    pos = off;
+    while(i < cnt){
+      begin_opn(WRITEBLOCKS);
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      if(off < 0)
+        pos = f->off;
+      for(room = MAXWRITE; i < cnt && room > 0; room -= r){
+        m = min(iov[i].iov_len - done, room);
+        if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, pos, m)) < 0)
+          r = 0;
+        pos += r;
+        tot += r;
+        done += r;
+        if(r != m)
+          break;
+        if(done == iov[i].iov_len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off < 0)
+        f->off = pos;
       iunlock(f->ip);
-      end_op();
+      end_opn(WRITEBLOCKS);
 
-      if(r != n1){
+      if(r != m){
         // error from writei
         break;
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
+    return i == cnt ? tot : -1;
   } else {
     panic("filewrite");
   }
+}
+
+// Write n bytes at kernel address src to f, a pipe or inode.
+static int
+filewritek(struct file *f, char *src, int n)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    return pipewrite(f->pipe, 0, (uint64)src, n);
+
+  begin_opn(WRITEBLOCKS);
+  ilock(f->ip);
+  if((r = writei(f->ip, 0, (uint64)src, f->off, n)) > 0)
+    f->off += r;
+  iunlock(f->ip);
+  end_opn(WRITEBLOCKS);
+  return r;
+}
+
+// Lock in's inode to splice from it: shared, like a read,
+// unless another process can move in->off too, so that
+// splicers sharing it take turns and send each byte once.
+// Returns whether the lock is exclusive.
+static int
+splicelock(struct file *in)
+{
+  if(fileshared(in)){
+    ilock(in->ip);
+    return 1;
+  }
+  ilock_shared(in->ip);
+  return 0;
+}
+
+static void
+spliceunlock(struct file *in, int excl)
+{
+  if(excl)
+    iunlock(in->ip);
+  else
+    iunlock_shared(in->ip);
+}
+
+// Write up to n bytes of in's inode, from in->off, to out,
+// straight from the buffer cache, advancing in->off past them.
+// The caller holds in->ip's lock, so no writei() can change
+// the blocks, and each block's own lock can be dropped (the
+// block stays pinned) while out is written, which may need
+// other blocks. For an inode out, the caller also holds its
+// lock and is in a transaction. A pipe out is only written as
+// far as it has room, since the pipe's reader might be
+// waiting for in->ip's lock.
+// Returns the number of bytes written, or -1.
+static int
+splicefrom(struct file *in, struct file *out, int n)
+{
+  struct buf *bp;
+  uint off;
+  int tot = 0, m, r;
 
-  return ret;
+  while(tot < n){
+    if((bp = ibread(in->ip, in->off)) == 0)
+      break;
+    off = in->off % BSIZE;
+    m = min(n - tot, BSIZE - off);
+    m = min(m, in->ip->size - in->off);
+    bpin(bp);
+    brelse(bp);
+    if(out->type == FD_PIPE)
+      r = pipeput(out->pipe, (char*)bp->data + off, m);
+    else if((r = writei(out->ip, 0, (uint64)bp->data + off, out->off, m)) > 0)
+      out->off += r;
+    bunpin(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    in->off += r;
+    tot += r;
+    if(r < m)
+      break;
+  }
+  return tot;
+}
+
+// Splice from an inode, up to MAXWRITE bytes per transaction
+// into an inode, or as much as fits at a time into a pipe.
+static int
+spliceinode(struct file *in, struct file *out, int n)
+{
+  int tot = 0, m, r, eof, excl;
+
+  while(tot < n){
+    m = n - tot;
+    if(out->type == FD_INODE){
+      m = min(m, MAXWRITE);
+      begin_opn(WRITEBLOCKS);
+      // lock the two inodes in address order, so that
+      // splices between them both ways can't deadlock.
+      if(out->ip < in->ip)
+        ilock(out->ip);
+      excl = splicelock(in);
+      if(out->ip > in->ip)
+        ilock(out->ip);
+    } else {
+      excl = splicelock(in);
+    }
+    r = splicefrom(in, out, m);
+    eof = in->off >= in->ip->size;
+    spliceunlock(in, excl);
+    if(out->type == FD_INODE){
+      iunlock(out->ip);
+      end_opn(WRITEBLOCKS);
+    }
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(eof || (r < m && out->type == FD_INODE))
+      break;
+    // wait for room in the pipe holding no inode lock.
+    if(r < m && pipewaitroom(out->pipe) < 0)
+      return tot > 0 ? tot : -1;
+  }
+  return tot;
 }
 
+// Splice from a pipe, through a kernel page.
+static int
+splicepipe(struct file *in, struct file *out, int n)
+{
+  char *page;
+  int r;
+
+  if(n == 0)
+    return 0;
+  if((page = kalloc()) == 0)
+    return -1;
+  if((r = piperead(in->pipe, 0, (uint64)page, min(n, PGSIZE))) > 0)
+    r = filewritek(out, page, r);
+  kfree(page);
+  return r;
+}
+
+// Move up to n bytes from file in to file out without a trip
+// through user memory. Each may be a pipe or an inode. Data
+// from an inode goes straight from the buffer cache to out;
+// from a pipe, it goes through a kernel page, and, as with
+// read(), only what the pipe holds is moved.
+// Returns the number of bytes moved, 0 at the end of in, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int dir;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if((in->type != FD_INODE && in->type != FD_PIPE) ||
+     (out->type != FD_INODE && out->type != FD_PIPE))
+    return -1;
+  if(in->type == FD_PIPE)
+    return splicepipe(in, out, n);
+  if(out->type == FD_INODE && in->ip == out->ip)
+    return -1;
+
+  // not from a directory, whose lock is taken before
+  // those of the files in it, e.g. by unlink().
+  ilock_shared(in->ip);
+  dir = in->ip->type == T_DIR;
+  iunlock_shared(in->ip);
+  if(dir)
+    return -1;
+  return spliceinode(in, out, n);
+}
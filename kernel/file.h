@@ -7,6 +7,7 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  struct file *next; // ftable free list
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,6 +19,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash chain
+  struct inode *lprev; // LRU list of unreferenced inodes
+  struct inode *lnext;
+  int onlru;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -38,3 +43,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define TRACE 2
@@ -46,24 +46,27 @@ fsinit(int dev) {
   initlog(dev, &sb);
 }
 
-// Zero a block.
+// Zero a block, which will hold file data if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, for file data if data is set.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, int data)
 {
   int b, bi, m;
   struct buf *bp;
@@ -77,7 +80,7 @@ balloc(uint dev)
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
+        bzero(dev, b + bi, data);
         return b + bi;
       }
     }
@@ -102,6 +105,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_freed(b);
 }
 
 // Inodes.
@@ -139,8 +143,9 @@ bfree(int dev, uint b)
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid. An entry whose ip->ref
+//   falls to zero stays valid, so that a later iget() of the
+//   same inode needn't read it again, until it is recycled.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,29 +169,160 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// Code that only examines an inode, such as read(), stat(),
+// exec() and path lookup, may lock it with ilock_shared()
+// and iunlock_shared() instead, so that readers of the same
+// file or directory needn't wait for one another. Either way,
+// the lock keeps the contents of the inode's blocks as they
+// are, since writei() needs it exclusively; splice() relies on
+// that to send blocks from the buffer cache unlocked.
+//
+// The itable is a hash table of entries, chained by dev and
+// inum. Each bucket's spin-lock protects its chain and the
+// ip->ref, ip->dev, and ip->inum of the entries on it, so one
+// must hold that lock while using any of those fields.
+//
+// itable.lrulock protects the LRU list of entries whose ref fell
+// to zero, which iget() recycles from, oldest first. iput() adds
+// an entry while still holding its bucket lock, so the entry is
+// never unreferenced and off the list. The list is lazy: an entry
+// stays on it when iget() revives it, and is dropped when found
+// referenced. itable.lock serializes recycling, which takes a
+// bucket lock; when the list has nothing to recycle, the table
+// grows by a page of entries. The lock order is itable.lock, then
+// a bucket lock, then itable.lrulock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 31
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;
+};
+
 struct {
   struct spinlock lock;
+  struct spinlock lrulock;
+  struct ibucket bucket[NIBUCKET];
+  struct inode lru;     // lru.lnext is most recently used
   struct inode inode[NINODE];
 } itable;
 
+static struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+// Put ip at the recent end of the LRU list.
+static void
+lruput(struct inode *ip)
+{
+  acquire(&itable.lrulock);
+  if(ip->onlru){
+    ip->lnext->lprev = ip->lprev;
+    ip->lprev->lnext = ip->lnext;
+  }
+  ip->lnext = itable.lru.lnext;
+  ip->lprev = &itable.lru;
+  itable.lru.lnext->lprev = ip;
+  itable.lru.lnext = ip;
+  ip->onlru = 1;
+  release(&itable.lrulock);
+}
+
+// Caller must hold itable.lrulock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+  ip->onlru = 0;
+}
+
+// Add n unused entries, with dev 0, to the LRU list.
+static void
+igrow(struct inode *ip, int n)
+{
+  for(; n > 0; n--, ip++){
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    lruput(ip);
+  }
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  int i;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&itable.lrulock, "itable.lru");
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&itable.bucket[i].lock, "itable.bucket");
+  itable.lru.lnext = itable.lru.lprev = &itable.lru;
+  igrow(itable.inode, NINODE);
+}
+
+// Take the least recently used unreferenced entry off its
+// hash chain and the LRU list, growing the table if there
+// is none. The caller owns the entry it returns.
+static struct inode*
+irecycle(void)
+{
+  struct ibucket *b;
+  struct inode *ip, **pp;
+
+  acquire(&itable.lock);
+  while(1){
+    acquire(&itable.lrulock);
+    ip = itable.lru.lprev;
+    if(ip == &itable.lru){
+      release(&itable.lrulock);
+      if((ip = (struct inode*)kalloc()) == 0)
+        panic("iget: no inodes");
+      igrow(ip, PGSIZE / sizeof(*ip));
+      continue;
+    }
+    if(ip->dev == 0){   // never used, or a spare given back
+      lruremove(ip);
+      release(&itable.lrulock);
+      break;
+    }
+    b = ibucket(ip->dev, ip->inum);
+    release(&itable.lrulock);
+
+    // b->lock comes before lrulock, so look again
+    // at ip once holding both.
+    acquire(&b->lock);
+    acquire(&itable.lrulock);
+    if(!ip->onlru || ip != itable.lru.lprev ||
+       ibucket(ip->dev, ip->inum) != b){
+      release(&itable.lrulock);   // changed meanwhile
+      release(&b->lock);
+      continue;
+    }
+    lruremove(ip);
+    release(&itable.lrulock);
+    if(ip->ref > 0){   // revived since it went on the list
+      release(&b->lock);
+      continue;
+    }
+    for(pp = &b->head; *pp && *pp != ip; pp = &(*pp)->next)
+      ;
+    if(*pp == 0){      // not in the table; leave it be
+      release(&b->lock);
+      continue;
+    }
+    *pp = ip->next;
+    release(&b->lock);
+    break;
   }
+  release(&itable.lock);
+  return ip;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,34 +382,44 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&itable.lock);
-
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
+  struct ibucket *b = ibucket(dev, inum);
+  struct inode *ip, *new;
+
+  new = 0;
+  while(1){
+    acquire(&b->lock);
+
+    // Is the inode already in the table?
+    for(ip = b->head; ip; ip = ip->next){
+      if(ip->dev == dev && ip->inum == inum){
+        ip->ref++;
+        release(&b->lock);
+        if(new){
+          // lost a race to add it; give back the spare.
+          new->dev = 0;
+          lruput(new);
+        }
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+    if(new)
+      break;
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Recycle an entry, without holding b->lock,
+    // then look again.
+    release(&b->lock);
+    new = irecycle();
+  }
 
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&itable.lock);
+  new->dev = dev;
+  new->inum = inum;
+  new->ref = 1;
+  new->valid = 0;
+  new->next = b->head;
+  b->head = new;
+  release(&b->lock);
 
-  return ip;
+  return new;
 }
 
 // Increment reference count for ip.
@@ -281,9 +427,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b = ibucket(ip->dev, ip->inum);
+
+  acquire(&b->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&b->lock);
   return ip;
 }
 
@@ -316,6 +464,27 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode shared, for reading only:
+// readi(), stati(), dirlookup() and the like.
+// Reads the inode from disk if necessary.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  acquiresleep_shared(&ip->lock);
+
+  if(ip->valid == 0){
+    // only an exclusive holder may read it in. once
+    // valid, it stays so while we hold a reference.
+    releasesleep_shared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleep_shared(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -326,9 +495,18 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || !holdingsleep_shared(&ip->lock) || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the LRU list, to be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -336,7 +514,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b = ibucket(ip->dev, ip->inum);
+
+  acquire(&b->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,8 +525,10 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&b->lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -354,11 +536,16 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&b->lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 0){
+    // if someone revives ip later, it sits on the
+    // list referenced until irecycle() drops it.
+    lruput(ip);
+  }
+  release(&b->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -384,10 +571,11 @@ bmap(struct inode *ip, uint bn)
 {
   uint addr, *a;
   struct buf *bp;
+  int data = ip->type == T_FILE;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, data);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -399,7 +587,7 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, 0);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
@@ -407,7 +595,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, data);
       if(addr){
         a[bn] = addr;
         log_write(bp);
@@ -453,7 +641,7 @@ itrunc(struct inode *ip)
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -465,7 +653,8 @@ stati(struct inode *ip, struct stat *st)
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared: every block
+// below ip->size exists, so bmap() won't allocate here.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
@@ -495,6 +684,21 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Return a locked buffer holding the block of ip that contains
+// byte off, or 0 if off is past the end of ip.
+// Caller must hold ip->lock, and brelse() the buffer.
+struct buf*
+ibread(struct inode *ip, uint off)
+{
+  uint addr;
+
+  if(off >= ip->size)
+    return 0;
+  if((addr = bmap(ip, off/BSIZE)) == 0)
+    return 0;
+  return bread(ip->dev, addr);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -523,7 +727,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_data(bp);    // not logged in ordered mode
+    else
+      log_write(bp);
     brelse(bp);
   }
 
@@ -546,32 +753,297 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hash a name for the directory index.
+// mkfs has a copy; keep the two the same.
+static ushort
+namehash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h ^ (h >> 16);
+}
+
+static int
+isdot(char *name)
+{
+  return namecmp(name, ".") == 0 || namecmp(name, "..") == 0;
+}
+
+// The i'th entry of the index in bp, a directory's block 0.
+static struct dxent*
+dxent(struct buf *bp, int i)
+{
+  struct dirent *de = (struct dirent*)bp->data + DXFIRST + i/DXPERSLOT;
+  return (struct dxent*)de->name + i%DXPERSLOT;
+}
+
+static int
+dxcount(struct buf *bp)
+{
+  int n;
+
+  for(n = 0; n < NDXENT && dxent(bp, n)->block != 0; n++)
+    ;
+  return n;
+}
+
+// Find the index entry for the leaf that holds hash h:
+// the last one whose hash is <= h. Returns -1 if no leaves.
+static int
+dxfind(struct buf *bp, int n, ushort h)
+{
+  int lo = 0, hi = n - 1, mid;
+
+  if(n == 0)
+    return -1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(dxent(bp, mid)->hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Set [*start, *end) to the byte range of dp that holds,
+// or would hold, name. Returns -1 if dp has no leaf yet.
+static int
+dirrange(struct inode *dp, char *name, uint *start, uint *end)
+{
+  struct buf *bp;
+  int i;
+
+  if(dp->size < BSIZE)
+    return -1;
+  if(isdot(name)){
+    *start = 0;
+    *end = DXFIRST * sizeof(struct dirent);
+    return 0;
+  }
+  bp = bread(dp->dev, bmap(dp, 0));
+  i = dxfind(bp, dxcount(bp), namehash(name));
+  if(i >= 0){
+    *start = dxent(bp, i)->block * BSIZE;
+    *end = *start + BSIZE;
+  }
+  brelse(bp);
+  return i < 0 ? -1 : 0;
+}
+
+// Search the dirents of dp in [start, end), which lie in one
+// block, for name, or for a free dirent if name is 0. Looks at
+// them in place in the buffer cache, not with a readi() each.
+// Returns the offset of the dirent found and sets *inum, or -1.
+static int
+dirscan(struct inode *dp, uint start, uint end, char *name, uint *inum)
+{
+  struct buf *bp;
+  struct dirent *de, *first, *last;
+  int off = -1;
+
+  bp = bread(dp->dev, bmap(dp, start/BSIZE));
+  first = (struct dirent*)(bp->data + start%BSIZE);
+  last = first + (end - start)/sizeof(*de);
+  for(de = first; de < last; de++){
+    if(name ? de->inum != 0 && namecmp(name, de->name) == 0 : de->inum == 0){
+      off = start + (de - first)*sizeof(*de);
+      *inum = de->inum;
+      break;
+    }
+  }
+  brelse(bp);
+  return off;
+}
+
+// Copy up to n of dp's dirents that are in use, starting at
+// byte offset *poff, to dst, a user virtual address if user_dst
+// is set. Advances *poff past the dirents looked at.
+// Returns the number copied, or -1 on a bad dst.
+// Caller must hold dp->lock.
+int
+dirread(struct inode *dp, int user_dst, uint64 dst, uint *poff, int n)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint off = *poff;
+  int tot = 0;
+
+  off -= off % sizeof(*de);
+  while(tot < n && off < dp->size){
+    bp = bread(dp->dev, bmap(dp, off/BSIZE));
+    for(de = (struct dirent*)(bp->data + off%BSIZE);
+        tot < n && (uchar*)de < bp->data + BSIZE && off < dp->size;
+        de++, off += sizeof(*de)){
+      if(de->inum == 0)
+        continue;
+      if(either_copyout(user_dst, dst, de, sizeof(*de)) == -1){
+        brelse(bp);
+        return -1;
+      }
+      dst += sizeof(*de);
+      tot++;
+    }
+    brelse(bp);
+  }
+  *poff = off;
+  return tot;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Consults the dcache first, and records what it finds there.
+// Caller must hold dp->lock, perhaps shared.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint start, end, inum;
+  int off;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
+  if(dcache_lookup(dp, name, &inum, &start)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = start;
+    return iget(dp->dev, inum);
+  }
+
+  if(dirrange(dp, name, &start, &end) < 0 ||
+     (off = dirscan(dp, start, end, name, &inum)) < 0){
+    dcache_enter(dp, name, 0, 0);
+    return 0;
+  }
+
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  dcache_enter(dp, name, inum, off);
+  return iget(dp->dev, inum);
+}
+
+// Add a leaf to dp, with block number *lb in dp.
+// Returns its buffer, or 0 if out of space.
+static struct buf*
+dxgrow(struct inode *dp, uint *lb)
+{
+  uint addr;
+
+  *lb = dp->size / BSIZE;
+  if(*lb >= MAXFILE || (addr = bmap(dp, *lb)) == 0)
+    return 0;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bread(dp->dev, addr);
+}
+
+// Split the full leaf of index entry i in two, moving its
+// higher half of hashes to a new leaf. Names with the same
+// hash stay together. Returns 0 on success, -1 on failure.
+static int
+dxsplit(struct inode *dp, struct buf *ibp, int i)
+{
+  struct buf *lbp, *nbp;
+  struct dirent *de, *nde;
+  ushort hash[BSIZE/sizeof(struct dirent)], h, split;
+  int n, j, k, nent = BSIZE/sizeof(struct dirent);
+  uint lb;
+
+  if((n = dxcount(ibp)) >= NDXENT)
+    return -1;
+
+  lbp = bread(dp->dev, bmap(dp, dxent(ibp, i)->block));
+  de = (struct dirent*)lbp->data;
+
+  // sort the leaf's hashes, and split at the median, or at
+  // the nearest change of hash to it.
+  for(j = 0; j < nent; j++){
+    h = namehash(de[j].name);
+    for(k = j; k > 0 && hash[k-1] > h; k--)
+      hash[k] = hash[k-1];
+    hash[k] = h;
+  }
+  for(k = nent/2; k < nent && hash[k] == hash[k-1]; k++)
+    ;
+  if(k == nent)
+    for(k = nent/2; k > 0 && hash[k] == hash[k-1]; k--)
+      ;
+  if(k == 0){
+    brelse(lbp);
+    return -1;   // every name has the same hash
+  }
+  split = hash[k];
+
+  if((nbp = dxgrow(dp, &lb)) == 0){
+    brelse(lbp);
+    return -1;
+  }
+  nde = (struct dirent*)nbp->data;
+  for(j = 0, k = 0; j < nent; j++){
+    if(namehash(de[j].name) < split)
       continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+    nde[k] = de[j];
+    memset(&de[j], 0, sizeof(de[j]));
+    dcache_enter(dp, nde[k].name, nde[k].inum, lb*BSIZE + k*sizeof(*nde));
+    k++;
+  }
+  log_write(nbp);
+  log_write(lbp);
+  brelse(nbp);
+  brelse(lbp);
+
+  for(j = n; j > i+1; j--)
+    *dxent(ibp, j) = *dxent(ibp, j-1);
+  dxent(ibp, i+1)->hash = split;
+  dxent(ibp, i+1)->block = lb;
+  log_write(ibp);
+  return 0;
+}
+
+// Find a free dirent for name in dp, splitting or adding
+// a leaf if need be. Returns its offset, or -1.
+static int
+dirslot(struct inode *dp, char *name)
+{
+  struct buf *ibp, *lbp;
+  uint start, lb, inum;
+  int i, off, tries;
+
+  if(isdot(name))
+    return namecmp(name, ".") == 0 ? 0 : sizeof(struct dirent);
+
+  ibp = bread(dp->dev, bmap(dp, 0));
+  if(dxcount(ibp) == 0){
+    // first name: dp's first leaf holds every hash.
+    if((lbp = dxgrow(dp, &lb)) == 0){
+      brelse(ibp);
+      return -1;
     }
+    brelse(lbp);
+    dxent(ibp, 0)->hash = 0;
+    dxent(ibp, 0)->block = lb;
+    log_write(ibp);
   }
 
-  return 0;
+  for(tries = 0; tries < 2; tries++){
+    i = dxfind(ibp, dxcount(ibp), namehash(name));
+    start = dxent(ibp, i)->block * BSIZE;
+    if((off = dirscan(dp, start, start + BSIZE, 0, &inum)) >= 0){
+      brelse(ibp);
+      return off;
+    }
+    if(tries == 0 && dxsplit(dp, ibp, i) < 0)
+      break;
+  }
+  brelse(ibp);
+  return -1;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -589,18 +1061,22 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // A new directory starts with an empty block 0.
+  if(dp->size == 0){
+    if(bmap(dp, 0) == 0)
+      return -1;
+    dp->size = BSIZE;
+    iupdate(dp);
   }
 
+  if((off = dirslot(dp, name)) < 0)
+    return -1;
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
@@ -659,21 +1135,22 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilock_shared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlock_shared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlock_shared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -20,10 +20,13 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // SB_ flags below
 };
 
 #define FSMAGIC 0x10203040
 
+#define SB_ORDERED 0x1    // file data is written home, not logged
+
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
@@ -58,3 +61,17 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Block 0 of a directory holds "." and "..", then an index of
+// the directory's other blocks (leaves), sorted by the lowest
+// name hash each leaf holds. The index is packed DXPERSLOT
+// entries to a dirent, in the name bytes of dirents whose inum
+// is 0, so the block still reads as an array of dirents.
+struct dxent {
+  ushort hash;       // lowest hash in the leaf
+  ushort block;      // leaf's block within the directory, 0 if unused
+};
+
+#define DXFIRST 2    // dirent holding the first index entries
+#define DXPERSLOT 3
+#define NDXENT ((BSIZE / sizeof(struct dirent) - DXFIRST) * DXPERSLOT)
+
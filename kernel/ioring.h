@@ -0,0 +1,41 @@
+// A ring of I/O requests that a process fills in its own memory
+// and hands to the kernel with one iosubmit() system call, which
+// carries out the requests in order and posts their results.
+
+#define IORING_SIZE 32  // entries in each ring; a power of two
+
+// operations
+#define IO_READ   1  // read(fd, addr, len), or pread() if off >= 0
+#define IO_WRITE  2  // write(fd, addr, len), or pwrite() if off >= 0
+#define IO_OPEN   3  // open(addr, len)
+#define IO_CLOSE  4  // close(fd)
+#define IO_FSTAT  5  // fstat(fd, addr)
+
+// a request.
+struct iosqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int len;
+  int off;
+  uint64 data;  // copied into the completion
+};
+
+// a completion.
+struct iocqe {
+  uint64 data;
+  int res;      // what the system call would have returned
+  int pad;
+};
+
+// the process adds requests at sq[sqtail % IORING_SIZE]
+// and takes completions from cq[cqhead % IORING_SIZE].
+// the kernel advances sqhead and cqtail.
+struct ioring {
+  uint sqhead;
+  uint sqtail;
+  uint cqhead;
+  uint cqtail;
+  struct iosqe sq[IORING_SIZE];
+  struct iocqe cq[IORING_SIZE];
+};
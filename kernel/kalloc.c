@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and 2-megabyte megapages for large user allocations.
 
 #include "types.h"
 #include "param.h"
@@ -18,16 +19,33 @@ struct run {
   struct run *next;
 };
 
+// RAM from the first megapage boundary after the kernel
+// starts out on megalist. kalloc() breaks a megapage up
+// into pages when freelist runs dry. zerolist holds up
+// to NZEROPG pages that are already zero, but for the link.
+// ref counts the extra references kdup() has handed out
+// to each page; kfree() drops one before freeing the page.
 struct {
   struct spinlock lock;
   struct run *freelist;
+  struct run *zerolist;
+  int nzero;
+  struct run *megalist;
+  uchar ref[(PHYSTOP-KERNBASE)/PGSIZE];
 } kmem;
 
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 void
 kinit()
 {
+  char *p;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  p = (char*)MEGAROUNDUP((uint64)end);
+  freerange(end, p);
+  for(; p + MEGASIZE <= (char*)PHYSTOP; p += MEGASIZE)
+    superfree(p);
 }
 
 void
@@ -51,8 +69,19 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] > 0){
+    // someone else still holds the page.
+    kmem.ref[PA2REF(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
+#ifdef KPOISON
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
@@ -68,15 +97,150 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  struct run *r;
+  struct run *r, *q;
+  char *p;
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r == 0 && (r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  } else if(r == 0 && (r = kmem.megalist) != 0){
+    // out of pages: break up a megapage.
+    kmem.megalist = r->next;
+    for(p = (char*)r + PGSIZE; p < (char*)r + MEGASIZE; p += PGSIZE){
+      q = (struct run*)p;
+      q->next = kmem.freelist;
+      kmem.freelist = q;
+    }
+  } else if(r)
     kmem.freelist = r->next;
   release(&kmem.lock);
 
+#ifdef KPOISON
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Take an extra reference to the allocated page pa, to be
+// dropped by kfree(). Returns -1 if there are too many.
+int
+kdup(void *pa)
+{
+  int r = -1;
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 255){
+    kmem.ref[PA2REF(pa)]++;
+    r = 0;
+  }
+  release(&kmem.lock);
+  return r;
+}
+
+// Does anyone besides the caller hold a reference to pa?
+int
+kshared(void *pa)
+{
+  int r;
+
+  acquire(&kmem.lock);
+  r = kmem.ref[PA2REF(pa)] > 0;
+  release(&kmem.lock);
+  return r;
+}
+
+// Allocate one 4096-byte page of zeroed memory, if possible
+// one that kzerofill() zeroed while the CPU was idle.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
+  release(&kmem.lock);
+
+  if(r){
+    r->next = 0;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero one free page for kzalloc(), unless NZEROPG
+// are zeroed already. Called by idle CPUs' scheduler().
+void
+kzerofill(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = 0;
+  if(kmem.nzero < NZEROPG && (r = kmem.freelist) != 0)
+    kmem.freelist = r->next;
+  release(&kmem.lock);
+
+  if(r == 0)
+    return;
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+}
+
+// Free a megapage, which normally should have been
+// returned by superalloc().
+void
+superfree(void *pa)
+{
+  struct run *r;
+
+  if(((uint64)pa % MEGASIZE) != 0 || (char*)pa < end || (uint64)pa + MEGASIZE > PHYSTOP)
+    panic("superfree");
+
+#ifdef KPOISON
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, MEGASIZE);
+#endif
+
+  r = (struct run*)pa;
+
+  acquire(&kmem.lock);
+  r->next = kmem.megalist;
+  kmem.megalist = r;
+  release(&kmem.lock);
+}
+
+// Allocate one 2-megabyte megapage of physical memory,
+// aligned to its size. Returns 0 if there is none left;
+// the caller can fall back to 4096-byte pages.
+void *
+superalloc(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.megalist;
+  if(r)
+    kmem.megalist = r->next;
+  release(&kmem.lock);
+
+#ifdef KPOISON
+  if(r)
+    memset((char*)r, 5, MEGASIZE); // fill with junk
+#endif
   return (void*)r;
 }
@@ -0,0 +1,88 @@
+// Lock microbenchmark, driven by user/lockbench.c.
+//
+// Each call takes and releases one of a few shared locks n
+// times, with a little work while holding it and between, so
+// that calls on several CPUs at once show how each kind of
+// lock behaves under contention. The kinds:
+//   0  test-and-set spinlock, as acquire() used to be
+//   1  ticket spinlock, i.e. acquire()
+//   2  sleeplock that sleeps at once, as acquiresleep() used to
+//   3  sleeplock that first spins on a running owner
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define HOLDWORK  50  // loop iterations with the lock held
+#define THINKWORK 50  // and between acquisitions
+
+struct {
+  uint tas;
+  struct spinlock ticket;
+  struct sleeplock sleep;
+  struct sleeplock adapt;
+  int count;
+} lb;
+
+void
+lockbenchinit(void)
+{
+  initlock(&lb.ticket, "lockbench");
+  initsleeplock(&lb.sleep, "lockbench sleep");
+  lb.sleep.spin = 0;
+  initsleeplock(&lb.adapt, "lockbench adapt");
+}
+
+static void
+work(int n)
+{
+  volatile int i;
+
+  for(i = 0; i < n; i++)
+    ;
+}
+
+// Take lock kind n times. Returns 0, or -1 if there's no such kind.
+int
+lockbench(int kind, int n)
+{
+  int i;
+
+  if(kind < 0 || kind > 3)
+    return -1;
+
+  for(i = 0; i < n; i++){
+    switch(kind){
+    case 0:
+      push_off();
+      while(__sync_lock_test_and_set(&lb.tas, 1) != 0)
+        ;
+      __sync_synchronize();
+      lb.count++;
+      work(HOLDWORK);
+      __sync_synchronize();
+      __sync_lock_release(&lb.tas);
+      pop_off();
+      break;
+    case 1:
+      acquire(&lb.ticket);
+      lb.count++;
+      work(HOLDWORK);
+      release(&lb.ticket);
+      break;
+    case 2:
+    case 3:
+      acquiresleep(kind == 2 ? &lb.sleep : &lb.adapt);
+      lb.count++;
+      work(HOLDWORK);
+      releasesleep(kind == 2 ? &lb.sleep : &lb.adapt);
+      break;
+    }
+    work(THINKWORK);
+  }
+  return 0;
+}
@@ -0,0 +1,12 @@
+// Lock contention statistics, per class of lock, i.e. per name
+// given to initlock() or initsleeplock(). See lockstat().
+#define LOCKNAME 16
+
+struct lockstat {
+  char name[LOCKNAME];
+  int sleep;         // 1 for a sleeplock, 0 for a spinlock
+  uint64 acquires;   // times acquired
+  uint64 contended;  // times acquired after waiting
+  uint64 spins;      // times round a loop waiting to acquire
+  uint64 hold;       // time held, in mtime cycles
+};
@@ -6,6 +6,14 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "trace.h"
+
+// most freed blocks a transaction keeps track of.
+#define NFREED (LOGSIZE*4)
+
+// most ordered data blocks a transaction holds in the cache
+// until commit; see NBUF.
+#define NDATA (LOGSIZE/2)
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -20,6 +28,15 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves room for MAXOPBLOCKS blocks; a system
+// call that writes more, like a large write(), can reserve
+// more with begin_opn()/end_opn().
+//
+// In ordered mode (SB_ORDERED), file data isn't logged. Instead
+// commit() writes it to its home blocks before the metadata that
+// refers to it commits, so it reaches the disk once, not twice.
+// Data blocks take no log space, so don't count against the
+// blocks that begin_opn() reserves.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -42,14 +59,21 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they may write, in all.
   int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
+  int ordered;     // don't log file data.
+  int ndata;       // file data blocks to write before commit.
+  struct buf *data[NDATA];
+  int nfreed;      // blocks freed by this transaction, or -1.
+  int freed[NFREED];
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void dropdata(int);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,6 +85,7 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.ordered = (sb->flags & SB_ORDERED) != 0;
   recover_from_log();
 }
 
@@ -126,15 +151,26 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// start an FS system call that may write up to n blocks.
+void
+begin_opn(int n)
+{
+  if(n > LOGSIZE - 1)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > LOGSIZE - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
@@ -145,11 +181,19 @@ begin_op(void)
 // commits if this was the last outstanding operation.
 void
 end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// end an FS system call started with begin_opn(n).
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
@@ -190,9 +234,27 @@ write_log(void)
   }
 }
 
+// Write ordered file data to its home blocks.
+static void
+write_data(void)
+{
+  int i;
+
+  for (i = 0; i < log.ndata; i++) {
+    struct buf *b = bread(log.dev, log.data[i]->blockno);
+    bwrite(b);
+    bunpin(b);
+    brelse(b);
+  }
+  log.ndata = 0;
+}
+
 static void
 commit()
 {
+  trace(TR_COMMIT, log.lh.n, 0);
+  write_data();   // Data home before the metadata that refers to it
+  log.nfreed = 0;
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
@@ -200,6 +262,7 @@ commit()
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
   }
+  trace(TR_COMMITDONE, 0, 0);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -231,6 +294,101 @@ log_write(struct buf *b)
     bpin(b);
     log.lh.n++;
   }
+  dropdata(b->blockno);
+  release(&log.lock);
+}
+
+static int
+inlist(int *list, int n, int blockno)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (list[i] == blockno)
+      return 1;
+  }
+  return 0;
+}
+
+// Index of blockno in log.data, or -1.
+// Caller must hold log.lock.
+static int
+indata(int blockno)
+{
+  int i;
+
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i]->blockno == blockno)
+      return i;
+  }
+  return -1;
+}
+
+// Take blockno off the list of data for commit() to write,
+// since it's been freed or is now logged as metadata.
+// Caller must hold log.lock.
+static void
+dropdata(int blockno)
+{
+  int i;
+
+  if ((i = indata(blockno)) < 0)
+    return;
+  bunpin(log.data[i]);
+  log.data[i] = log.data[--log.ndata];
+}
+
+// Like log_write(), but for a block of file data. In ordered mode
+// the block goes on a list for commit() to write home, rather than
+// into the log. A block freed earlier in this transaction is logged
+// anyway: until the commit, it may still be an indirect block or a
+// directory on disk.
+void
+log_data(struct buf *b)
+{
+  if(!log.ordered){
+    log_write(b);
+    return;
+  }
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+  if (inlist(log.lh.block, log.lh.n, b->blockno) ||
+      log.nfreed < 0 || inlist(log.freed, log.nfreed, b->blockno)) {
+    release(&log.lock);
+    log_write(b);
+    return;
+  }
+  if (indata(b->blockno) < 0) {
+    if (log.ndata == NDATA) {
+      // too many held for the commit; write this one home
+      // now, which is as good as writing it at the commit.
+      release(&log.lock);
+      bwrite(b);
+      return;
+    }
+    log.data[log.ndata++] = b;
+    bpin(b);
+  }
   release(&log.lock);
 }
 
+// Note that this transaction freed blockno, so that log_data()
+// logs it if it's reused for file data before the commit, and
+// so that commit() doesn't write it home as data: it may be
+// reused as metadata before then.
+void
+log_freed(uint blockno)
+{
+  if(!log.ordered)
+    return;
+
+  acquire(&log.lock);
+  dropdata(blockno);
+  if (log.nfreed == NFREED)
+    log.nfreed = -1;        // too many; log all data until commit
+  else if (log.nfreed >= 0)
+    log.freed[log.nfreed++] = blockno;
+  release(&log.lock);
+}
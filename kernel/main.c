@@ -26,7 +26,11 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcacheinit();    // directory name cache
     fileinit();      // file table
+    lockbenchinit(); // lock microbenchmark
+    profinit();      // sampling profiler
+    traceinit();     // tracepoints
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
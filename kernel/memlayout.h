@@ -55,6 +55,11 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
+// User memory lies below USERTOP. Every process's page table
+// also maps the kernel (see kvmshare() in vm.c), and the
+// devices from the PLIC up share the low 1GB with user memory.
+#define USERTOP PLIC
+
 // User memory layout.
 // Address zero first:
 //   text
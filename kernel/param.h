@@ -1,13 +1,23 @@
-#define NPROC        64  // maximum number of processes
+#define MAXPROC    1000  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process, before it grows
+#define MAXOFILE   4096  // most open files per process
+#define NFILE       100  // open files per system at boot; it grows
+#define NINODE       50  // i-nodes in the table at boot; it grows
+#define NDENTRY     128  // size of directory name-lookup cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*12) // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*20) // size of disk block cache; holds the log and ordered data
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NZEROPG      128   // pages the idle loop keeps zeroed
+#define PIPESIZE     16384 // bytes buffered per pipe, multiple of 4096
+#define SLEEPSPIN    1000  // times acquiresleep() checks a running owner
+#define NLOCKCLASS   64    // lock names lockstat() tracks
+#define TICKCYCLES   1000000 // mtime cycles per clock tick; 1/10th second in qemu
+#define NPROFSAMPLE  512   // profiler samples buffered per CPU
+#define PROFMULT     10    // profiler samples per clock tick
+#define NTRACE       1024  // trace events buffered per CPU
@@ -8,17 +8,35 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define NPIPEPG (PIPESIZE/PGSIZE)
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// the PIPESIZE-byte ring buffer is split into pages. a whole,
+// page-aligned page of a write can be lent to the pipe by the
+// writer (see uvmloan()) instead of copied; loan[i] then holds
+// the ring's data for page i in place of buf[i].
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *buf[NPIPEPG];
+  char *loan[NPIPEPG];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < NPIPEPG; i++){
+    if(pi->buf[i])
+      kfree(pi->buf[i]);
+    if(pi->loan[i])
+      kfree(pi->loan[i]);
+  }
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,8 +46,11 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kzalloc()) == 0)
     goto bad;
+  for(int i = 0; i < NPIPEPG; i++)
+    if((pi->buf[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -47,7 +68,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +89,19 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr to the pipe. If user_src==1, then addr
+// is a user virtual address; otherwise, it is a kernel address.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m, pg;
+  uint off;
+  uint64 pa;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +110,25 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    pg = (pi->nwrite % PIPESIZE) / PGSIZE;
+    off = pi->nwrite % PGSIZE;
+    if(pi->nwrite == pi->nread + PIPESIZE || pi->loan[pg]){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+    } else if(user_src && off == 0 && n - i >= PGSIZE && (addr + i) % PGSIZE == 0 &&
+              pi->nwrite + PGSIZE <= pi->nread + PIPESIZE &&
+              (pa = uvmloan(pr->pagetable, addr + i)) != 0){
+      // lend the whole user page to the pipe.
+      pi->loan[pg] = (char*)pa;
+      pi->nwrite += PGSIZE;
+      i += PGSIZE;
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = min(n - i, PGSIZE - off);
+      m = min(m, pi->nread + PIPESIZE - pi->nwrite);
+      if(either_copyin(pi->buf[pg] + off, user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -102,12 +137,65 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   return i;
 }
 
+// Write up to n bytes at kernel address src to the pipe,
+// without waiting for room. Returns the number written,
+// perhaps 0, or -1 if the read end is closed.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipeput(struct pipe *pi, char *src, int n)
 {
-  int i;
+  int i, m, pg;
+  uint off;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  for(i = 0; i < n; i += m){
+    pg = (pi->nwrite % PIPESIZE) / PGSIZE;
+    off = pi->nwrite % PGSIZE;
+    if(pi->nwrite == pi->nread + PIPESIZE || pi->loan[pg])
+      break;
+    m = min(n - i, PGSIZE - off);
+    m = min(m, pi->nread + PIPESIZE - pi->nwrite);
+    memmove(pi->buf[pg] + off, src + i, m);
+    pi->nwrite += m;
+  }
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return i;
+}
+
+// Wait until the pipe has room for a write.
+// Returns 0, or -1 if the read end is closed or we're killed.
+int
+pipewaitroom(struct pipe *pi)
+{
+  acquire(&pi->lock);
+  while(pi->nwrite == pi->nread + PIPESIZE ||
+        pi->loan[(pi->nwrite % PIPESIZE) / PGSIZE]){
+    if(pi->readopen == 0 || killed(myproc()))
+      break;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || killed(myproc())){
+    release(&pi->lock);
+    return -1;
+  }
+  release(&pi->lock);
+  return 0;
+}
+
+// Read up to n bytes from the pipe to addr, a user virtual
+// address if user_dst==1, or else a kernel address.
+int
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
+{
+  int i, m, pg;
+  uint off;
+  char *src;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,12 +205,20 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    pg = (pi->nread % PIPESIZE) / PGSIZE;
+    off = pi->nread % PGSIZE;
+    m = min(n - i, PGSIZE - off);
+    m = min(m, pi->nwrite - pi->nread);
+    src = pi->loan[pg] ? pi->loan[pg] : pi->buf[pg];
+    if(either_copyout(user_dst, addr + i, src + off, m) == -1)
       break;
+    pi->nread += m;
+    if(pi->loan[pg] && pi->nread % PGSIZE == 0){
+      // done with the lent page.
+      kfree(pi->loan[pg]);
+      pi->loan[pg] = 0;
+    }
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
@@ -4,58 +4,118 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "trace.h"
+#include "pstat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table. procs are allocated a page at a time,
+// as needed, up to MAXPROC, and never freed, so a pointer to
+// one stays valid even after the process is gone. Every proc
+// is on the all list, which only grows, at its head, so it can
+// be walked without a lock. Unused procs are on the free list.
+struct {
+  struct spinlock lock;  // protects free, nproc, and adding to all
+  struct proc *all;
+  struct proc *free;
+  int nproc;             // procs allocated
+} ptable;
+
+#define PROCPERPG (PGSIZE / sizeof(struct proc))
+
+// Each process's pid hashes to a chain here, for kill() &c.
+// Acquire pidtable.lock after, not before, any p->lock.
+#define NPIDHASH 64
+struct {
+  struct spinlock lock;
+  struct proc *hash[NPIDHASH];
+} pidtable;
 
 struct proc *initproc;
 
 int nextpid = 1;
-struct spinlock pid_lock;
+
+// mask of CPUs that have entered scheduler().
+uint64 onlinecpus;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// RISC-V address-space identifiers (ASIDs) tag TLB entries, so
+// switching satp between page tables with different ASIDs needs
+// no TLB flush. ASID 0 belongs to the kernel page table. User
+// ASIDs are handed out in generations: when a generation runs
+// out, a new one begins, every process's ASID goes stale, and
+// each CPU flushes its whole TLB before it next loads a user ASID.
+struct {
+  struct spinlock lock;
+  uint64 gen;    // current generation
+  uint next;     // next unused ASID in this generation
+  uint max;      // largest ASID the MMU implements, 0 if none
+} asids;
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Add a page of procs to the free list. Each has its own
+// kernel stack, mapped high in memory, followed by an invalid
+// guard page. Returns 0, or -1 if at MAXPROC or out of memory.
+// Caller must hold ptable.lock.
+static int
+procgrow(void)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  struct proc *p, *pg;
+  int i;
+
+  if(ptable.nproc + PROCPERPG > MAXPROC || (pg = (struct proc*)kalloc()) == 0)
+    return -1;
+  memset(pg, 0, PGSIZE);
+  for(i = 0, p = pg; i < PROCPERPG; i++, p++){
+    if(kvmstack(KSTACK(ptable.nproc)) < 0)
+      break;
+    initlock(&p->lock, "proc");
+    p->state = UNUSED;
+    p->lastcpu = -1;
+    p->kstack = KSTACK(ptable.nproc++);
+    p->freenext = ptable.free;
+    ptable.free = p;
+    p->allnext = ptable.all;
+    __sync_synchronize();   // p is ready before it's on the list
+    ptable.all = p;
   }
+  return i > 0 ? 0 : -1;
+}
+
+// find out how many ASID bits the MMU implements by
+// writing all ones to satp's ASID field and reading it back.
+static void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asid");
+  w_satp(satp | SATP_ASID_MASK);
+  asids.max = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+  w_satp(satp);
+  sfence_vma();
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
-  initlock(&pid_lock, "nextpid");
+  asidinit();
+  initlock(&ptable.lock, "ptable");
+  initlock(&pidtable.lock, "pidtable");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
 }
 
 // Must be called with interrupts disabled,
@@ -92,18 +152,40 @@ myproc(void)
 int
 allocpid()
 {
-  int pid;
-  
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
+  return __sync_fetch_and_add(&nextpid, 1);
+}
 
-  return pid;
+static struct proc**
+pidchain(int pid)
+{
+  return &pidtable.hash[(uint)pid % NPIDHASH];
+}
+
+// Return the process with the given pid, with its lock held,
+// or 0 if there is none.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pidtable.lock);
+  for(p = *pidchain(pid); p && p->pid != pid; p = p->pidnext)
+    ;
+  release(&pidtable.lock);
+  if(p == 0)
+    return 0;
+
+  // p may have exited and been reused since; look again.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
+// Take a proc off the free list, growing the table if it
+// is empty. Initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
@@ -111,19 +193,27 @@ allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&ptable.lock);
+  if(ptable.free == 0 && procgrow() < 0){
+    release(&ptable.lock);
+    return 0;
   }
-  return 0;
+  p = ptable.free;
+  ptable.free = p->freenext;
+  release(&ptable.lock);
 
-found:
+  acquire(&p->lock);
   p->pid = allocpid();
   p->state = USED;
+  acquire(&pidtable.lock);
+  p->pidnext = *pidchain(p->pid);
+  *pidchain(p->pid) = p;
+  release(&pidtable.lock);
+  p->affinity = ~0L;
+  p->lastcpu = -1;
+  p->utime = p->stime = 0;
+  p->nvcsw = p->nivcsw = p->nfault = 0;
+  p->nrblock = p->nwblock = p->nsyscall = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -155,20 +245,39 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p->pagetable, p->sz, p->kstack);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid){
+    acquire(&pidtable.lock);
+    for(pp = pidchain(p->pid); *pp != p; pp = &(*pp)->pidnext)
+      ;
+    *pp = p->pidnext;
+    release(&pidtable.lock);
+  }
   p->pid = 0;
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->asidgen = 0;
+  p->affinity = 0;
+  p->lastcpu = -1;
   p->state = UNUSED;
+
+  acquire(&ptable.lock);
+  p->freenext = ptable.free;
+  ptable.free = p;
+  release(&ptable.lock);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -202,19 +311,73 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the kernel and p's kernel stack, so that the
+  // kernel can run on this page table on p's behalf.
+  if(kvmshare(pagetable, p->kstack) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 sz, uint64 kstack)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  kvmunshare(pagetable, kstack);
   uvmfree(pagetable, sz);
 }
 
+// Return the satp value that switches to p's page table,
+// first making sure p holds an ASID from the current generation
+// and flushing any TLB entries on this CPU that might be stale.
+// Called by scheduler() and usertrapret() with interrupts off.
+uint64
+proc_satp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 gen = asids.gen;
+
+  if(asids.max == 0){
+    // no ASIDs: all user page tables share ASID 0.
+    sfence_vma();
+    return MAKE_SATP(p->pagetable, 0);
+  }
+
+  if(p->asidgen != gen || c->asidgen != gen){
+    acquire(&asids.lock);
+    if(p->asidgen != asids.gen){
+      if(asids.next > asids.max){
+        asids.gen++;
+        asids.next = 1;
+      }
+      p->asid = asids.next++;
+      p->asidgen = asids.gen;
+    }
+    if(c->asidgen != asids.gen){
+      // ASIDs from the previous generation may be reused.
+      sfence_vma();
+      c->asidgen = asids.gen;
+    }
+    release(&asids.lock);
+  } else if(p->asidcpu != id || p->tlbstale){
+    // p last ran elsewhere (and may have changed its page
+    // table there), or changed it here since it was loaded.
+    sfence_vma_asid(p->asid);
+  }
+  p->asidcpu = id;
+  p->tlbstale = 0;
+
+  return MAKE_SATP(p->pagetable, p->asid);
+}
+
 // a user program that calls exec("/init")
 // assembled from ../user/initcode.S
 // od -t xC ../user/initcode
@@ -268,9 +431,13 @@ growproc(int n)
       return -1;
     }
   } else if(n < 0){
+    // a megapage that the new end cuts through must be split.
+    if(uvmsplit(p->pagetable, sz + n) < 0)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
+  p->tlbstale = 1;
   return 0;
 }
 
@@ -279,7 +446,8 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
+  uint64 affinity;
   struct proc *np;
   struct proc *p = myproc();
 
@@ -303,9 +471,13 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+  if(fdfork(np, p) < 0){
+    // p still holds these files, so closing them won't sleep.
+    fdcloseall(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
@@ -316,9 +488,17 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
   release(&wait_lock);
 
+  // the child may run on the same CPUs as its parent.
+  acquire(&p->lock);
+  affinity = p->affinity;
+  release(&p->lock);
+
   acquire(&np->lock);
+  np->affinity = affinity;
   np->state = RUNNABLE;
   release(&np->lock);
 
@@ -332,12 +512,15 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    p->children = pp->sibling;
+    pp->parent = initproc;
+    pp->sibling = initproc->children;
+    initproc->children = pp;
   }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -352,13 +535,7 @@ exit(int status)
     panic("init exiting");
 
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  fdcloseall(p);
 
   begin_op();
   iput(p->cwd);
@@ -390,41 +567,38 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *pp;
-  int havekids, pid;
+  struct proc *pp, **link;
+  int pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    // Scan through our children looking for exited ones.
+    for(link = &p->children; (pp = *link) != 0; link = &pp->sibling){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        *link = pp->sibling;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->children == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -441,32 +615,58 @@ wait(uint64 addr)
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+//
+// A CPU only runs processes whose p->affinity includes it.
+// Each round first looks only at processes that last ran on
+// this CPU (or have never run), so that they find their cache
+// and TLB state still warm; if there are none, any allowed
+// process will do.
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  int pass, found;
   
   c->proc = 0;
+  __sync_fetch_and_or(&onlinecpus, 1L << id);
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    found = 0;
+    for(pass = 0; pass < 2 && !found; pass++){
+      for(p = ptable.all; p; p = p->allnext) {
+        acquire(&p->lock);
+        if(p->state == RUNNABLE && (p->affinity & (1L << id)) &&
+           (pass == 1 || p->lastcpu == id || p->lastcpu < 0)) {
+          // Switch to chosen process.  It is the process's job
+          // to release its lock and then reacquire it
+          // before jumping back to us.
+          p->state = RUNNING;
+          p->lastcpu = id;
+          c->proc = p;
+          // p's page table maps the kernel too; run on it.
+          w_satp(proc_satp(p));
+          trace(TR_SWITCH, p->pid, 0);
+          p->tstamp = r_time();
+          swtch(&c->context, &p->context);
+          trace(TR_SWITCH, 0, p->pid);
+
+          // Process is done running for now.
+          // It should have changed its p->state before coming back.
+          // Leave its page table, which wait() may free.
+          kvmswitch();
+          c->proc = 0;
+          found = 1;
+        }
+        release(&p->lock);
       }
-      release(&p->lock);
+    }
+    if(!found){
+      // nothing to run: prepare a zeroed page for kzalloc().
+      kzerofill();
     }
   }
 }
@@ -494,6 +694,7 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  p->stime += r_time() - p->tstamp;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
@@ -505,6 +706,7 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  p->nivcsw++;
   sched();
   release(&p->lock);
 }
@@ -550,6 +752,7 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->nvcsw++;
 
   sched();
 
@@ -568,7 +771,7 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(p = ptable.all; p; p = p->allnext) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
@@ -587,20 +790,57 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
   }
-  return -1;
+  release(&p->lock);
+  return 0;
+}
+
+// Restrict the process with the given pid (0 means the caller)
+// to the CPUs in mask. Returns 0, or -1 if there is no such
+// process or mask names no CPU that is running the scheduler.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  struct proc *me = myproc();
+
+  if((mask & onlinecpus) == 0)
+    return -1;
+  if(pid == 0)
+    pid = me->pid;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  release(&p->lock);
+  // give the scheduler a chance to move us
+  // if this CPU is no longer allowed.
+  if(p == me)
+    yield();
+  return 0;
+}
+
+// Return the CPU mask of the process with the given pid
+// (0 means the caller), or -1 if there is no such process.
+int
+getaffinity(int pid, uint64 *mask)
+{
+  struct proc *p;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  *mask = p->affinity & onlinecpus;
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -655,22 +895,23 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
+static char *states[] = {
+[UNUSED]    "unused",
+[USED]      "used",
+[SLEEPING]  "sleep ",
+[RUNNABLE]  "runble",
+[RUNNING]   "run   ",
+[ZOMBIE]    "zombie"
+};
+
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [USED]      "used",
-  [SLEEPING]  "sleep ",
-  [RUNNABLE]  "runble",
-  [RUNNING]   "run   ",
-  [ZOMBIE]    "zombie"
-  };
   struct proc *p;
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -681,3 +922,45 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Copy out a struct pstat for each of up to n processes
+// to addr, a user virtual address.
+// Returns the number copied, or -1.
+int
+procstat(uint64 addr, int n)
+{
+  struct proc *p;
+  struct pstat ps;
+  int i = 0, j;
+
+  for(p = ptable.all; p && i < n; p = p->allnext){
+    acquire(&wait_lock);
+    acquire(&p->lock);
+    if(p->state == UNUSED){
+      release(&p->lock);
+      release(&wait_lock);
+      continue;
+    }
+    ps.pid = p->pid;
+    ps.ppid = p->parent ? p->parent->pid : 0;
+    safestrcpy(ps.state, states[p->state], sizeof(ps.state));
+    for(j = strlen(ps.state); j > 0 && ps.state[j-1] == ' '; j--)
+      ps.state[j-1] = 0;
+    safestrcpy(ps.name, p->name, sizeof(ps.name));
+    ps.sz = p->sz;
+    ps.utime = p->utime;
+    ps.stime = p->stime;
+    ps.vcsw = p->nvcsw;
+    ps.ivcsw = p->nivcsw;
+    ps.faults = p->nfault;
+    ps.rblocks = p->nrblock;
+    ps.wblocks = p->nwblock;
+    ps.syscalls = p->nsyscall;
+    release(&p->lock);
+    release(&wait_lock);
+    if(copyout(myproc()->pagetable, addr + i*sizeof(ps), (char*)&ps, sizeof(ps)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this CPU's TLB was last flushed for.
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,6 +35,8 @@ extern struct cpu cpus[NCPU];
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
+// kernel_satp is the process's own page table, which maps the
+// kernel as well (see kvmshare() in vm.c).
 // usertrapret() and userret in trampoline.S set up
 // the trapframe's kernel_*, restore user registers from the
 // trapframe, switch to the user page table, and enter user space.
@@ -41,7 +44,7 @@ extern struct cpu cpus[NCPU];
 // return-to-user path via usertrapret() doesn't return through
 // the entire kernel call stack.
 struct trapframe {
-  /*   0 */ uint64 kernel_satp;   // kernel page table
+  /*   0 */ uint64 kernel_satp;   // page table for the kernel
   /*   8 */ uint64 kernel_sp;     // top of process's kernel stack
   /*  16 */ uint64 kernel_trap;   // usertrap()
   /*  24 */ uint64 epc;           // saved user program counter
@@ -81,6 +84,10 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// fds above NOFILE live in pages of FDPERPG.
+#define FDPERPG (PGSIZE / sizeof(struct file*))
+#define NOFILEPG ((MAXOFILE - NOFILE + FDPERPG - 1) / FDPERPG)
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,17 +98,44 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 affinity;             // Mask of CPUs allowed to run this process
+  int lastcpu;                 // CPU this process last ran on, or -1
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Parent's next child
+
+  struct proc *allnext;        // ptable.all list; never changes
+  struct proc *freenext;       // ptable.free list
+  struct proc *pidnext;        // pid hash chain
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint asid;                   // Address-space identifier for pagetable
+  uint64 asidgen;              // Generation asid belongs to, 0 if none
+  int asidcpu;                 // CPU whose TLB last loaded asid
+  int tlbstale;                // pagetable changed since asid was loaded
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct file **ofilepg[NOFILEPG]; // More open files, a page each
+  uint64 fdmap[MAXOFILE/64];   // Bit per fd in use
+  uint64 fdfull;               // Bit per full fdmap word
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+
+  // accounting, for procstat(). only the process itself
+  // updates these, except the scheduler sets tstamp.
+  uint64 tstamp;               // r_time() when utime or stime last grew
+  uint64 utime;                // mtime cycles in user space
+  uint64 stime;                // mtime cycles in the kernel
+  uint64 nvcsw;                // sleeps
+  uint64 nivcsw;               // yields
+  uint64 nfault;               // page faults
+  uint64 nrblock;              // blocks read from disk
+  uint64 nwblock;              // blocks written to disk
+  uint64 nsyscall;             // system calls
 };
@@ -0,0 +1,132 @@
+// Sampling profiler.
+//
+// While profiling is on, each hart's timer interrupts come
+// PROFMULT times as often, and each records where it
+// interrupted in that hart's ring of samples. Only every
+// PROFMULT'th is a clock tick, so ticks keep their length.
+// Each ring has a single writer, its hart's timer interrupt,
+// so adding a sample needs no lock; profread() empties the
+// rings, holding prof.lock against other readers.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+// in start.c; each hart's timer interval is scratch[4].
+extern uint64 timer_scratch[NCPU][5];
+
+struct profring {
+  uint head;         // next sample to write
+  uint tail;         // next sample to read
+  uint intr;         // timer interrupts while profiling
+  struct profsample buf[NPROFSAMPLE];
+};
+
+struct {
+  struct spinlock lock;
+  int on;
+  struct profring ring[NCPU];
+} prof;
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+}
+
+// Turn profiling on, discarding old samples, or off.
+void
+profile(int on)
+{
+  struct profring *r;
+  int i;
+
+  acquire(&prof.lock);
+  on = on != 0;
+  if(on != prof.on){
+    if(on){
+      for(r = prof.ring; r < &prof.ring[NCPU]; r++){
+        r->tail = r->head;
+        r->intr = 0;
+      }
+    }
+    __sync_synchronize();
+    prof.on = on;
+    for(i = 0; i < NCPU; i++)
+      timer_scratch[i][4] = on ? TICKCYCLES / PROFMULT : TICKCYCLES;
+  }
+  release(&prof.lock);
+}
+
+// Called at each timer interrupt, from devintr().
+// Returns 1 if this interrupt is also a clock tick.
+int
+proftick(void)
+{
+  struct profring *r;
+  struct profsample *s;
+  struct proc *p;
+
+  if(!prof.on)
+    return 1;
+  r = &prof.ring[cpuid()];
+  if(r->head - *(volatile uint *)&r->tail < NPROFSAMPLE){
+    s = &r->buf[r->head % NPROFSAMPLE];
+    s->pc = r_sepc();
+    s->user = (r_sstatus() & SSTATUS_SPP) == 0;
+    s->cpu = cpuid();
+    if((p = myproc()) != 0){
+      s->pid = p->pid;
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    } else {
+      s->pid = 0;
+      safestrcpy(s->name, "-", sizeof(s->name));
+    }
+    __sync_synchronize();
+    r->head++;
+  }
+  return ++r->intr % PROFMULT == 0;
+}
+
+// Copy up to n samples to addr, a user virtual address, as
+// an array of struct profsample. Waits for some if there are
+// none yet. Returns the number copied, 0 once profiling is
+// off and every sample has been read, or -1.
+int
+profread(uint64 addr, int n)
+{
+  struct profring *r;
+  int got, on;
+
+  for(;;){
+    got = 0;
+    acquire(&prof.lock);
+    for(r = prof.ring; r < &prof.ring[NCPU] && got < n; r++){
+      while(r->tail != *(volatile uint *)&r->head && got < n){
+        __sync_synchronize();
+        if(copyout(myproc()->pagetable, addr + got*sizeof(struct profsample),
+                   (char*)&r->buf[r->tail % NPROFSAMPLE], sizeof(struct profsample)) < 0){
+          release(&prof.lock);
+          return -1;
+        }
+        __sync_synchronize();
+        r->tail++;
+        got++;
+      }
+    }
+    on = prof.on;
+    release(&prof.lock);
+    if(got > 0 || !on || n <= 0)
+      return got;
+    if(killed(myproc()))
+      return -1;
+    // the clock tick wakes us to look again.
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
@@ -0,0 +1,9 @@
+// A sample taken by the profiler at a timer interrupt.
+// See profile() and profread().
+struct profsample {
+  uint64 pc;         // where the timer interrupted
+  int pid;           // process running, or 0 if none
+  uchar cpu;         // hart that took the sample
+  uchar user;        // 1 if pc is in user space
+  char name[16];     // name of the process running
+};
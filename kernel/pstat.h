@@ -0,0 +1,16 @@
+// What procstat() reports about each process.
+struct pstat {
+  int pid;
+  int ppid;          // parent's pid, or 0
+  char state[8];     // "run", "sleep", &c.
+  char name[16];
+  uint64 sz;         // bytes of memory
+  uint64 utime;      // mtime cycles run in user space
+  uint64 stime;      // and in the kernel
+  uint64 vcsw;       // times it gave up the CPU to wait
+  uint64 ivcsw;      // times it was made to give up the CPU
+  uint64 faults;     // page faults
+  uint64 rblocks;    // blocks read from disk
+  uint64 wblocks;    // blocks written to disk
+  uint64 syscalls;   // system calls made
+};
@@ -15,18 +15,52 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->owner = 0;
+  lk->spin = SLEEPSPIN;
   lk->pid = 0;
+  lk->class = lockclass(name, 1);
+}
+
+// While the owner of lk is running on another CPU, it will
+// likely release lk sooner than it would take us to sleep and
+// be woken, so spin for a while, up to lk->spin times, first.
+// Looks at lk without its spinlock, so only as a hint; procs
+// are never freed, so owner can still be looked at even if it
+// has since exited. Returns the number of times it looked.
+static int
+spinonowner(struct sleeplock *lk)
+{
+  struct proc *o;
+  int n;
+
+  for(n = 0; n < lk->spin; n++){
+    o = *(struct proc * volatile *)&lk->owner;
+    if(o == 0 || o == myproc() || *(volatile enum procstate *)&o->state != RUNNING)
+      break;
+  }
+  return n;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int spins, slept = 0;
+
+  spins = spinonowner(lk);
   acquire(&lk->lk);
-  while (lk->locked) {
+  while (lk->locked || lk->readers) {
+    // hold off new readers only while actually waiting.
+    lk->wwait++;
     sleep(lk, &lk->lk);
+    lk->wwait--;
+    slept = 1;
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
+  lk->t0 = lockacquired(lk->class, slept, spins);
   release(&lk->lk);
 }
 
@@ -34,7 +68,9 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lockheld(lk->class, lk->t0);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
@@ -51,5 +87,50 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Hold lk shared with other readers. A waiting writer
+// holds off new readers, so that it isn't starved.
+// A process must not acquire the same lock shared twice.
+// lockstat() counts shared acquisitions, but not how
+// long they hold the lock.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  int spins, slept = 0;
+
+  spins = spinonowner(lk);
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait) {
+    sleep(lk, &lk->lk);
+    slept = 1;
+  }
+  lk->readers++;
+  lockacquired(lk->class, slept, spins);
+  release(&lk->lk);
+}
+
+void
+releasesleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleep_shared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Is lk held shared, by someone? Readers aren't
+// recorded, so this can't tell whether it's us.
+int
+holdingsleep_shared(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->readers > 0;
+  release(&lk->lk);
+  return r;
+}
+
 
 
@@ -1,10 +1,20 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either exclusively, by one process, or shared,
+// by any number of readers.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int wwait;         // Number waiting to hold it exclusively
+  struct proc *owner; // Process holding lock exclusively
+  int spin;          // How long to spin on a running owner
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
-  int pid;           // Process holding lock
+  int pid;           // Process holding lock exclusively
+
+  // For lockstat():
+  int class;         // 1 + index of the lock's class, or 0
+  uint64 t0;         // r_time() when acquired exclusively, if counting
 };
 
@@ -6,14 +6,123 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
+// Contention statistics, per class of lock and per CPU, so that
+// counting needs neither a lock nor atomics. A class is all the
+// spinlocks, or sleeplocks, with the same name. Off unless
+// turned on with lockcount(), since it would otherwise cost
+// every acquire() and release() two reads of the time.
+struct {
+  uint lock;   // a bare test-and-set lock, since initlock() uses it
+  int on;
+  int n;
+  struct lockstat class[NLOCKCLASS];      // name and sleep only
+  struct lockstat cpu[NCPU][NLOCKCLASS];  // counters only
+} lockstats;
+
+// Return 1 + the index of the class of locks called name,
+// adding it if it is new, or 0 if there's no room for it.
+int
+lockclass(char *name, int sleep)
+{
+  struct lockstat *c;
+  int i;
+
+  if(name == 0)
+    return 0;
+  // interrupts off, as in acquire(): callers may already hold
+  // a spinlock, and a holder mustn't be preempted here.
+  push_off();
+  while(__sync_lock_test_and_set(&lockstats.lock, 1) != 0)
+    ;
+  __sync_synchronize();
+  for(i = 0; i < lockstats.n; i++){
+    c = &lockstats.class[i];
+    if(c->sleep == sleep && strncmp(c->name, name, LOCKNAME-1) == 0)
+      break;
+  }
+  if(i == lockstats.n && i < NLOCKCLASS){
+    safestrcpy(lockstats.class[i].name, name, LOCKNAME);
+    lockstats.class[i].sleep = sleep;
+    lockstats.n++;
+  }
+  __sync_synchronize();
+  __sync_lock_release(&lockstats.lock);
+  pop_off();
+  return i < NLOCKCLASS ? i + 1 : 0;
+}
+
+// Turn counting on or off; returns whether it was on.
+// Counts are kept while it is off.
+int
+lockcount(int on)
+{
+  return __sync_lock_test_and_set(&lockstats.on, on != 0);
+}
+
+// Count an acquisition of a lock of class c (as from lockclass()),
+// which waited spins times round a loop, or slept if contended.
+// Returns the time, to pass to lockheld() on release,
+// or 0 if not counting. Interrupts must be off.
+uint64
+lockacquired(int c, int contended, uint64 spins)
+{
+  struct lockstat *s;
+
+  if(c == 0 || lockstats.on == 0)
+    return 0;
+  s = &lockstats.cpu[cpuid()][c-1];
+  s->acquires++;
+  if(contended || spins)
+    s->contended++;
+  s->spins += spins;
+  return r_time();
+}
+
+// Count the time since t0, from lockacquired(), spent
+// holding a lock of class c. Interrupts must be off.
+void
+lockheld(int c, uint64 t0)
+{
+  if(c && t0)
+    lockstats.cpu[cpuid()][c-1].hold += r_time() - t0;
+}
+
+// Copy out statistics for up to n classes of locks to addr,
+// a user virtual address, as an array of struct lockstat.
+// Returns the number copied, or -1.
+int
+getlockstats(uint64 addr, int n)
+{
+  struct lockstat s;
+  int i, cpu;
+
+  if(n > lockstats.n)
+    n = lockstats.n;
+  for(i = 0; i < n; i++){
+    s = lockstats.class[i];
+    for(cpu = 0; cpu < NCPU; cpu++){
+      s.acquires += lockstats.cpu[cpu][i].acquires;
+      s.contended += lockstats.cpu[cpu][i].contended;
+      s.spins += lockstats.cpu[cpu][i].spins;
+      s.hold += lockstats.cpu[cpu][i].hold;
+    }
+    if(copyout(myproc()->pagetable, addr + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return n;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->class = lockclass(name, 0);
 }
 
 // Acquire the lock.
@@ -21,15 +130,23 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint t;
+  uint64 spins;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  // Take a ticket, and wait for it to come up. Unlike a
+  // test-and-set loop, this serves waiters in order, and
+  // they spin with plain loads, which don't take the line
+  // away from the holder or from one another.
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
   //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+  //   s1 = &lk->next
+  //   amoadd.w a5, a5, (s1)
+  t = __sync_fetch_and_add(&lk->next, 1);
+  for(spins = 0; *(volatile uint *)&lk->owner != t; spins++)
     ;
 
   // Tell the C compiler and the processor to not move loads or stores
@@ -40,6 +157,7 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->t0 = lockacquired(lk->class, 0, spins);
 }
 
 // Release the lock.
@@ -49,6 +167,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lockheld(lk->class, lk->t0);
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +178,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Release the lock to the next ticket, equivalent to
+  // lk->owner++. This code doesn't use a C assignment, since
+  // the C standard implies that an assignment might be
+  // implemented with multiple store instructions.
+  __sync_fetch_and_add(&lk->owner, 1);
 
   pop_off();
 }
@@ -77,7 +193,7 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
   return r;
 }
 
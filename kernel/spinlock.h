@@ -1,9 +1,15 @@
 // Mutual exclusion lock.
+// A ticket lock: CPUs get the lock in the order they ask.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket now holding the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat():
+  int class;         // 1 + index of the lock's class, or 0
+  uint64 t0;         // r_time() when acquired, if counting
 };
 
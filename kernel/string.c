@@ -1,13 +1,41 @@
 #include "types.h"
 
+// memset(), memcmp() and memmove() work 8 bytes at a time
+// where alignment allows: pages are zeroed whole, and the
+// buffer cache, log and uvmcopy() move whole blocks and pages.
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && ((uint64)cdst & 7)){
+    *cdst++ = c;
+    n--;
+  }
+  if(n >= 8){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wdst = (uint64 *) cdst;
+    for(; n >= 64; n -= 64, wdst += 8){
+      wdst[0] = w;
+      wdst[1] = w;
+      wdst[2] = w;
+      wdst[3] = w;
+      wdst[4] = w;
+      wdst[5] = w;
+      wdst[6] = w;
+      wdst[7] = w;
+    }
+    for(; n >= 8; n -= 8)
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +46,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    while(n > 0 && ((uint64)s1 & 7)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the byte loop finds the difference.
+    while(n >= 8 && *(uint64 *)s1 == *(uint64 *)s2)
+      s1 += 8, s2 += 8, n -= 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +70,59 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
+  int words;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  // whole words can be moved if src and dst are equally
+  // aligned. even when they overlap, each word is read
+  // before any store could reach it.
+  words = (((uint64)s ^ (uint64)d) & 7) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      while(n > 0 && ((uint64)d & 7)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 8; n -= 8)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while(n > 0 && ((uint64)d & 7)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 32; n -= 32, ws += 4, wd += 4){
+        uint64 w0 = ws[0], w1 = ws[1], w2 = ws[2], w3 = ws[3];
+        wd[0] = w0;
+        wd[1] = w1;
+        wd[2] = w2;
+        wd[3] = w3;
+      }
+      for(; n >= 8; n -= 8)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -5,6 +5,8 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "trace.h"
+#include "sysstat.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -101,6 +103,23 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_getaffinity(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_iosubmit(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_lockbench(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_profile(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_procstat(void);
+extern uint64 sys_syscount(void);
+extern uint64 sys_sysstat(void);
+extern uint64 sys_lockcount(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,19 +145,110 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getaffinity] sys_getaffinity,
+[SYS_splice]  sys_splice,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_iosubmit] sys_iosubmit,
+[SYS_getdents] sys_getdents,
+[SYS_lockbench] sys_lockbench,
+[SYS_lockstat] sys_lockstat,
+[SYS_profile] sys_profile,
+[SYS_profread] sys_profread,
+[SYS_procstat] sys_procstat,
+[SYS_syscount] sys_syscount,
+[SYS_sysstat] sys_sysstat,
+[SYS_lockcount] sys_lockcount,
 };
 
+// Counts and latency histograms, per system call and per CPU,
+// so that counting needs neither a lock nor atomics. Off
+// unless turned on with syscount(), costing syscall() only
+// a test of sysstats.on.
+struct {
+  int on;
+  struct sysstat cpu[NCPU][NELEM(syscalls)];
+} sysstats;
+
+// Turn counting on or off; returns whether it was on.
+// Counts are kept while it is off.
+int
+syscount(int on)
+{
+  return __sync_lock_test_and_set(&sysstats.on, on != 0);
+}
+
+// Charge a call to num that took t cycles to this CPU.
+static void
+sysstatadd(int num, uint64 t)
+{
+  struct sysstat *s;
+  uint64 x;
+  int b;
+
+  push_off();  // stay on this CPU; no interrupt handler counts.
+  s = &sysstats.cpu[cpuid()][num];
+  s->count++;
+  s->time += t;
+  if(t > s->max)
+    s->max = t;
+  for(b = 0, x = t; x > 1 && b < NSYSHIST-1; x >>= 1)
+    b++;
+  s->hist[b]++;
+  pop_off();
+}
+
+// Copy the counts for system calls 0 to n-1, summed over the
+// CPUs, to a user virtual address, as an array of struct
+// sysstat indexed by system call number.
+// Returns the number copied, or -1.
+int
+getsysstats(uint64 addr, int n)
+{
+  struct sysstat s, *c;
+  int i, j, cpu;
+
+  if(n > NELEM(syscalls))
+    n = NELEM(syscalls);
+  for(i = 0; i < n; i++){
+    memset(&s, 0, sizeof(s));
+    for(cpu = 0; cpu < NCPU; cpu++){
+      c = &sysstats.cpu[cpu][i];
+      s.count += c->count;
+      s.time += c->time;
+      if(c->max > s.max)
+        s.max = c->max;
+      for(j = 0; j < NSYSHIST; j++)
+        s.hist[j] += c->hist[j];
+    }
+    if(copyout(myproc()->pagetable, addr + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return n;
+}
+
 void
 syscall(void)
 {
-  int num;
+  int num, timed;
+  uint64 t0 = 0;
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
+  p->nsyscall++;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
+    trace(TR_SYSCALL, num, 0);
+    if((timed = sysstats.on) != 0)
+      t0 = r_time();
     p->trapframe->a0 = syscalls[num]();
+    if(timed)
+      sysstatadd(num, r_time() - t0);
+    trace(TR_SYSRET, num, p->trapframe->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
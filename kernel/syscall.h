@@ -20,3 +20,20 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setaffinity 22
+#define SYS_getaffinity 23
+#define SYS_splice 24
+#define SYS_readv  25
+#define SYS_writev 26
+#define SYS_pread  27
+#define SYS_pwrite 28
+#define SYS_iosubmit 29
+#define SYS_getdents 30
+#define SYS_lockbench 31
+#define SYS_lockstat 32
+#define SYS_profile 33
+#define SYS_profread 34
+#define SYS_procstat 35
+#define SYS_syscount 36
+#define SYS_sysstat 37
+#define SYS_lockcount 38
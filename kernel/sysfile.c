@@ -15,6 +15,14 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "ioring.h"
+
+// Return the open file for file descriptor fd, or 0.
+static struct file*
+fdfile(int fd)
+{
+  return fdget(myproc(), fd);
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -25,7 +33,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdfile(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -39,16 +47,7 @@ argfd(int n, int *pfd, struct file **pf)
 static int
 fdalloc(struct file *f)
 {
-  int fd;
-  struct proc *p = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
+  return fdinstall(myproc(), f);
 }
 
 uint64
@@ -94,6 +93,100 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// fetch the iovec array argument of readv() and writev().
+static int
+argiov(struct iovec *iov, int *cnt)
+{
+  uint64 uiov, tot = 0;
+
+  argaddr(1, &uiov);
+  argint(2, cnt);
+  if(*cnt < 0 || *cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, *cnt * sizeof(iov[0])) < 0)
+    return -1;
+  // the total must fit in the int result.
+  for(int i = 0; i < *cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff || (tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// read at an offset, without using or moving the file's own.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int n, off;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int n, off;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// move up to n bytes from fd in to fd out in the kernel.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 uint64
 sys_close(void)
 {
@@ -102,7 +195,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdclear(myproc(), fd);
   fileclose(f);
   return 0;
 }
@@ -119,6 +212,21 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// read up to n directory entries that are in use.
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 p;
+  int n;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filegetdents(f, p, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -173,16 +281,10 @@ bad:
 static int
 isdirempty(struct inode *dp)
 {
-  int off;
+  uint off = 2*sizeof(struct dirent);   // skip . and ..
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
+  return dirread(dp, 0, (uint64)&de, &off, 1) == 0;
 }
 
 uint64
@@ -222,6 +324,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -301,18 +404,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path in mode omode, returning a new file descriptor or -1.
+static int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -370,6 +468,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -488,18 +598,102 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdclear(p, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdclear(p, fd0);
+    fdclear(p, fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+// carry out one request from an I/O ring.
+static int
+iodo(struct iosqe *e)
+{
+  struct file *f;
+  struct iovec iov;
+  char path[MAXPATH];
+
+  if(e->op == IO_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, e->len);
+  }
+  if((f = fdfile(e->fd)) == 0)
+    return -1;
+  switch(e->op){
+  case IO_READ:
+  case IO_WRITE:
+    if(e->len < 0 || e->off < -1)
+      return -1;
+    iov.iov_base = (void*)e->addr;
+    iov.iov_len = e->len;
+    if(e->op == IO_READ)
+      return filereadv(f, &iov, 1, e->off);
+    return filewritev(f, &iov, 1, e->off);
+  case IO_CLOSE:
+    fdclear(myproc(), e->fd);
+    fileclose(f);
+    return 0;
+  case IO_FSTAT:
+    return filestat(f, e->addr);
+  }
+  return -1;
+}
+
+// Carry out the requests queued in the I/O ring at user address
+// ring, in order, posting a completion for each, until the
+// submission queue is empty or the completion queue is full.
+// One trap thus pays for a whole batch of system calls.
+// Returns the number of requests carried out, or -1.
+uint64
+sys_iosubmit(void)
+{
+  struct proc *p = myproc();
+  struct { uint sqhead, sqtail, cqhead, cqtail; } r; // start of struct ioring
+  struct iosqe e;
+  struct iocqe c;
+  uint64 ring, sq, cq;
+  int n = 0;
+
+  argaddr(0, &ring);
+  sq = ring + sizeof(r);
+  cq = sq + IORING_SIZE*sizeof(struct iosqe);
+  if(copyin(p->pagetable, (char*)&r, ring, sizeof(r)) < 0)
+    return -1;
+  if(r.sqtail - r.sqhead > IORING_SIZE || r.cqtail - r.cqhead > IORING_SIZE)
+    return -1;
+
+  while(r.sqhead != r.sqtail && r.cqtail - r.cqhead < IORING_SIZE){
+    if(copyin(p->pagetable, (char*)&e,
+              sq + (r.sqhead % IORING_SIZE)*sizeof(e), sizeof(e)) < 0)
+      return -1;
+    c.data = e.data;
+    c.res = iodo(&e);
+    c.pad = 0;
+    if(copyout(p->pagetable, cq + (r.cqtail % IORING_SIZE)*sizeof(c),
+               (char*)&c, sizeof(c)) < 0)
+      return -1;
+    r.sqhead++;
+    r.cqtail++;
+    n++;
+    // publish progress as we go, in case a later request fails.
+    // only the fields the kernel owns: the process may be adding
+    // requests or taking completions meanwhile.
+    if(copyout(p->pagetable, ring, (char*)&r.sqhead, sizeof(r.sqhead)) < 0 ||
+       copyout(p->pagetable, ring + ((char*)&r.cqtail - (char*)&r),
+               (char*)&r.cqtail, sizeof(r.cqtail)) < 0)
+      return -1;
+    if(killed(p))
+      break;
+  }
+  return n;
+}
@@ -77,6 +77,128 @@ sys_kill(void)
   return kill(pid);
 }
 
+// restrict a process to a set of CPUs.
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, (uint)mask);
+}
+
+// return the set of CPUs a process may run on.
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  if(getaffinity(pid, &mask) < 0)
+    return -1;
+  return (int)mask;
+}
+
+// take and release a benchmark lock many times.
+uint64
+sys_lockbench(void)
+{
+  int kind, n;
+
+  argint(0, &kind);
+  argint(1, &n);
+  return lockbench(kind, n);
+}
+
+// copy out contention statistics for each class of lock.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  return getlockstats(addr, n);
+}
+
+// turn lock statistics on or off.
+uint64
+sys_lockcount(void)
+{
+  int on;
+
+  argint(0, &on);
+  return lockcount(on);
+}
+
+// turn the sampling profiler on or off.
+uint64
+sys_profile(void)
+{
+  int on;
+
+  argint(0, &on);
+  profile(on);
+  return 0;
+}
+
+// read samples taken by the profiler.
+uint64
+sys_profread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  return profread(addr, n);
+}
+
+// report on each process.
+uint64
+sys_procstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  return procstat(addr, n);
+}
+
+// turn system call counting on or off.
+uint64
+sys_syscount(void)
+{
+  int on;
+
+  argint(0, &on);
+  return syscount(on);
+}
+
+// read system call counts and latencies.
+uint64
+sys_sysstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  return getsysstats(addr, n);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -0,0 +1,10 @@
+// System call counts and latencies, per system call number.
+// See sysstat().
+#define NSYSHIST 32
+
+struct sysstat {
+  uint64 count;         // calls that returned
+  uint64 time;          // mtime cycles spent in those calls
+  uint64 max;           // longest call, in mtime cycles
+  uint hist[NSYSHIST];  // calls taking [2^i, 2^(i+1)) cycles; hist[0] also 0
+};
@@ -0,0 +1,127 @@
+// Kernel tracepoints.
+//
+// While tracing is on, trace() adds an event to this hart's
+// ring, for reading through the trace device. Adding needs no
+// lock: a hart's ring has only that hart writing it, with
+// interrupts off, and a reader, holding trace.lock, which
+// only moves the tail. Events that don't fit are dropped.
+// Writing '1' to the device turns tracing on, discarding any
+// old events, and '0' turns it off. A read waits while tracing
+// is on and no events are ready, and returns 0 once it is off
+// and every event has been read.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "proc.h"
+#include "trace.h"
+#include "defs.h"
+
+struct tracering {
+  uint head;         // next event to write
+  uint tail;         // next event to read
+  struct traceevent buf[NTRACE];
+};
+
+struct {
+  struct spinlock lock;
+  int on;
+  struct tracering ring[NCPU];
+} tr;
+
+// Record an event of the given type, if tracing is on.
+void
+trace(int type, uint a, uint b)
+{
+  struct tracering *r;
+  struct traceevent *e;
+  struct proc *p;
+
+  if(!tr.on)
+    return;
+  push_off();
+  r = &tr.ring[cpuid()];
+  if(r->head - *(volatile uint *)&r->tail < NTRACE){
+    e = &r->buf[r->head % NTRACE];
+    e->time = r_time();
+    e->type = type;
+    e->cpu = cpuid();
+    e->pid = (p = mycpu()->proc) ? p->pid : 0;
+    e->a = a;
+    e->b = b;
+    __sync_synchronize();
+    r->head++;
+  }
+  pop_off();
+}
+
+// Read whole events into dst, user or kernel.
+static int
+traceread(int user_dst, uint64 dst, int n)
+{
+  struct tracering *r;
+  int got, on;
+
+  n /= sizeof(struct traceevent);
+  for(;;){
+    got = 0;
+    acquire(&tr.lock);
+    for(r = tr.ring; r < &tr.ring[NCPU] && got < n; r++){
+      while(r->tail != *(volatile uint *)&r->head && got < n){
+        __sync_synchronize();
+        if(either_copyout(user_dst, dst + got*sizeof(struct traceevent),
+                          &r->buf[r->tail % NTRACE], sizeof(struct traceevent)) < 0){
+          release(&tr.lock);
+          return -1;
+        }
+        __sync_synchronize();
+        r->tail++;
+        got++;
+      }
+    }
+    on = tr.on;
+    release(&tr.lock);
+    if(got > 0 || !on || n <= 0)
+      return got * sizeof(struct traceevent);
+    if(killed(myproc()))
+      return -1;
+    // the clock tick wakes us to look again.
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
+
+// '1' turns tracing on, '0' off.
+static int
+tracewrite(int user_src, uint64 src, int n)
+{
+  struct tracering *r;
+  char c;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) < 0)
+    return -1;
+  if(c != '0' && c != '1')
+    return -1;
+  acquire(&tr.lock);
+  if(c == '1' && !tr.on){
+    for(r = tr.ring; r < &tr.ring[NCPU]; r++)
+      r->tail = r->head;
+    __sync_synchronize();
+  }
+  tr.on = c == '1';
+  release(&tr.lock);
+  return n;
+}
+
+void
+traceinit(void)
+{
+  initlock(&tr.lock, "trace");
+  devsw[TRACE].read = traceread;
+  devsw[TRACE].write = tracewrite;
+}
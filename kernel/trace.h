@@ -0,0 +1,20 @@
+// Kernel trace events, read from the trace device.
+
+#define TR_SYSCALL    1  // entering system call a
+#define TR_SYSRET     2  // leaving system call a, returning b
+#define TR_SWITCH     3  // switching to pid a, from pid b; 0 is the scheduler
+#define TR_BREAD      4  // read block a of device b ...
+#define TR_BREADHIT   5  // ... or found it in the cache
+#define TR_BWRITE     6  // write block a of device b
+#define TR_DISKSUBMIT 7  // gave block a to the disk, to write if b
+#define TR_DISKDONE   8  // disk is done with block a
+#define TR_COMMIT     9  // committing a logged blocks
+#define TR_COMMITDONE 10 // commit done
+
+struct traceevent {
+  uint64 time;       // r_time(), in mtime cycles
+  ushort type;       // TR_...
+  uchar cpu;         // hart the event happened on
+  int pid;           // process running, or 0 if none
+  uint a, b;         // as type says
+};
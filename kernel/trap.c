@@ -11,6 +11,9 @@ uint ticks;
 
 extern char trampoline[], uservec[], userret[];
 
+// in uaccess.S, copies to and from user memory.
+extern char ucopystart[], ucopyend[], ucopyfault[];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -49,6 +52,15 @@ usertrap(void)
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
+
+  // the time since usertrapret() was spent in user space.
+  uint64 now = r_time();
+  p->utime += now - p->tstamp;
+  p->tstamp = now;
+
+  // count page faults, whether or not they're handled below.
+  if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15)
+    p->nfault++;
   
   if(r_scause() == 8){
     // system call
@@ -67,6 +79,8 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 15 && uvmunloan(p->pagetable, r_stval()) == 0){
+    // wrote to a page lent to a pipe; now it has its own copy.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -96,13 +110,23 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // the time since usertrap(), or since the scheduler ran us,
+  // was spent in the kernel.
+  uint64 now = r_time();
+  p->stime += now - p->tstamp;
+  p->tstamp = now;
+
   // send syscalls, interrupts, and exceptions to uservec in trampoline.S
   uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
   w_stvec(trampoline_uservec);
 
+  // p's page table, tagged with its ASID. it maps the kernel
+  // too, so uservec keeps using it when p next traps.
+  uint64 satp = proc_satp(p);
+
   // set up trapframe values that uservec will need when
   // the process next traps into the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = satp;             // page table for the kernel
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -119,11 +143,8 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
-
   // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
+  // switches to p's page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
   ((void (*)(uint64))trampoline_userret)(satp);
@@ -144,7 +165,21 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // we may have interrupted copyuser() in uaccess.S. don't let
+  // handlers, or other processes if we yield, touch user memory;
+  // the w_sstatus() below puts SUM back.
+  if(sstatus & SSTATUS_SUM)
+    w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopystart && sepc < (uint64)ucopyend){
+    // a copy to or from user memory faulted. retry a write
+    // to a lent page once it's writable again; otherwise,
+    // e.g. writing to a read-only page, make it return -1.
+    myproc()->nfault++;
+    if(scause != 15 || uvmunloan(myproc()->pagetable, r_stval()) != 0)
+      sepc = (uint64)ucopyfault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
@@ -204,8 +239,10 @@ devintr()
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
+    // while profiling, only some of these are clock ticks.
+    int tick = proftick();
 
-    if(cpuid() == 0){
+    if(tick && cpuid() == 0){
       clockintr();
     }
     
@@ -213,7 +250,7 @@ devintr()
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    return tick ? 2 : 1;
   } else {
     return 0;
   }
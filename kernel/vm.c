@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,7 +17,14 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// uaccess.S
+int copyuser(void *, void *, uint64);
+int copyuserstr(char *, char *, uint64);
+
 // Make a direct-map page table for the kernel.
+// Every process's page table shares the mappings of the
+// devices and of RAM, so they are global (PTE_G).
+// mappages() uses megapages for most of RAM.
 pagetable_t
 kvmmake(void)
 {
@@ -25,27 +34,26 @@ kvmmake(void)
   memset(kpgtbl, 0, PGSIZE);
 
   // uart registers
-  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W | PTE_G);
 
   // map kernel text executable and read-only.
-  kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
+  kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X | PTE_G);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_G);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // kernel stacks are added by kvmstack() as procs are.
+
   return kpgtbl;
 }
 
@@ -64,12 +72,120 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Switch this CPU back to the kernel's own page table, once
+// the process whose page table it was running on has given up
+// the CPU. Both map the kernel identically with global PTEs,
+// so no TLB flush is needed.
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
+}
+
+// Allocate a page for a new process's kernel stack, and map
+// it at va in the kernel page table, where kvmshare() finds it.
+// Returns 0, or -1 if out of memory.
+int
+kvmstack(uint64 va)
+{
+  char *pa;
+
+  if((pa = kalloc()) == 0)
+    return -1;
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    kfree(pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Make a process's page table map the kernel as well, so that
+// the kernel can keep running on it while working for the
+// process, and reach the process's memory with ordinary loads
+// and stores (see copyin()). The kernel's mappings are shared
+// with kernel_pagetable by pointing at its page-table pages,
+// except that only this process's kernel stack, at kstack, is
+// mapped. Returns 0 on success, -1 if out of memory.
+int
+kvmshare(pagetable_t pagetable, uint64 kstack)
+{
+  pagetable_t l1, kl1;
+  pte_t *pte;
+  int i;
+
+  // the devices share the low 1GB with user memory,
+  // so that level-1 page holds entries of both.
+  if((pagetable[0] & PTE_V) == 0){
+    if((l1 = (pagetable_t)kzalloc()) == 0)
+      return -1;
+    pagetable[0] = PA2PTE(l1) | PTE_V;
+  }
+  l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(i = PX(1, USERTOP); i < 512; i++)
+    l1[i] = kl1[i];
+
+  for(i = 1; i < PX(2, TRAMPOLINE); i++)
+    pagetable[i] = kernel_pagetable[i];
+
+  if((pte = walk(kernel_pagetable, kstack, 0)) == 0 || (*pte & PTE_V) == 0)
+    panic("kvmshare: kstack");
+  if(mappages(pagetable, kstack, PGSIZE, PTE2PA(*pte), PTE_R | PTE_W) != 0){
+    kvmunshare(pagetable, kstack);
+    return -1;
+  }
+  return 0;
+}
+
+// Remove the kernel's mappings from a process's page table,
+// so that freewalk() won't free the kernel's page-table pages.
+void
+kvmunshare(pagetable_t pagetable, uint64 kstack)
+{
+  pagetable_t l1;
+  pte_t *pte;
+  int i;
+
+  if((pte = walk(pagetable, kstack, 0)) != 0)
+    *pte = 0;
+  for(i = 1; i < PX(2, TRAMPOLINE); i++)
+    pagetable[i] = 0;
+  if(pagetable[0] & PTE_V){
+    l1 = (pagetable_t)PTE2PA(pagetable[0]);
+    for(i = PX(1, USERTOP); i < 512; i++)
+      l1[i] = 0;
+  }
+}
+
+// Like walk(), but stop at the PTE in the level-level
+// page-table page, or at a leaf above it.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int level)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        return pte;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(level, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,46 +198,54 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE at level 1 maps a 2-megabyte megapage; if va
+// lies in one, walk() returns that PTE.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
+  return walklevel(pagetable, va, alloc, 0);
+}
 
+// Like walk() without alloc, and set *size to the number
+// of bytes the returned PTE maps (if it is valid).
+static pte_t *
+walksize(pagetable_t pagetable, uint64 va, uint64 *size)
+{
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(*pte & (PTE_R|PTE_W|PTE_X)){
+      *size = (uint64)PGSIZE << (9*level);
+      return pte;
     }
+    pagetable = (pagetable_t)PTE2PA(*pte);
   }
+  *size = PGSIZE;
   return &pagetable[PX(0, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Look up a virtual address, return the physical address
+// of its page, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  uint64 pa, sz;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walksize(pagetable, va, &sz);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + PGROUNDDOWN(va % sz);
   return pa;
 }
 
@@ -137,12 +261,13 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// be page-aligned. Wherever va and pa are both megapage-aligned
+// and a whole megapage fits, map a megapage. Returns 0 on
+// success, -1 if walk() couldn't allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, sz;
   pte_t *pte;
 
   if(size == 0)
@@ -151,56 +276,96 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    sz = PGSIZE;
+    pte = 0;
+    if(a % MEGASIZE == 0 && pa % MEGASIZE == 0 && last - a >= MEGASIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if((*pte & PTE_V) && (*pte & (PTE_R|PTE_W|PTE_X)) == 0)
+        pte = 0;  // already has a page-table page; use pages.
+      else
+        sz = MEGASIZE;
+    }
+    if(pte == 0 && (pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(a + sz - PGSIZE == last)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += sz;
+    pa += sz;
   }
   return 0;
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. The mappings must exist, and any megapages
+// must lie wholly inside the range (see uvmsplit()).
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, sz;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
+  for(a = va; a < va + npages*PGSIZE; a += sz){
+    if((pte = walksize(pagetable, a, &sz)) == 0)
       panic("uvmunmap: walk");
     if((*pte & PTE_V) == 0)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(sz != PGSIZE && (a % sz != 0 || va + npages*PGSIZE - a < sz))
+      panic("uvmunmap: part of a megapage");
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      if(sz == PGSIZE)
+        kfree((void*)pa);
+      else
+        superfree((void*)pa);
     }
     *pte = 0;
   }
 }
 
+// If va, rounded up to a page, lies inside a megapage rather
+// than at its start, remap that megapage with 4096-byte pages,
+// so that the part from va up can be unmapped.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pagetable_t l0;
+  pte_t *pte;
+  uint64 pa, sz;
+
+  va = PGROUNDUP(va);
+  if(va >= MAXVA || va % MEGASIZE == 0)
+    return 0;
+  if((pte = walksize(pagetable, va, &sz)) == 0 || sz != MEGASIZE)
+    return 0;
+  if((l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(l0) | PTE_V;
+  return 0;
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,33 +379,44 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Aligned stretches of at least 2 megabytes get megapages when
+// there are any left.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
-  uint64 a;
+  uint64 a, sz;
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > USERTOP)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+  for(a = oldsz; a < newsz; a += sz){
+    sz = PGSIZE;
+    mem = 0;
+    if(a % MEGASIZE == 0 && newsz - a >= MEGASIZE && (mem = superalloc()) != 0){
+      sz = MEGASIZE;
+      memset(mem, 0, sz);
+    } else
+      mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
-      kfree(mem);
+    if(mappages(pagetable, a, sz, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+      if(sz == PGSIZE)
+        kfree(mem);
+      else
+        superfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -306,17 +482,27 @@ int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa, i, n;
   uint flags;
   char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
+  for(i = 0; i < sz; i += n){
+    if((pte = walksize(old, i, &n)) == 0)
       panic("uvmcopy: pte should exist");
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
+    pa = PTE2PA(*pte) + i % n;
     flags = PTE_FLAGS(*pte);
+    if(n != PGSIZE && i % n == 0 && (mem = superalloc()) != 0){
+      // give the child a megapage too.
+      memmove(mem, (char*)pa, n);
+      if(mappages(new, i, n, (uint64)mem, flags) != 0){
+        superfree(mem);
+        goto err;
+      }
+      continue;
+    }
+    n = PGSIZE;
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -345,6 +531,106 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Lend the user page at va, in the current process's page
+// table, to the kernel without copying it: take a reference to
+// it with kdup(), and withhold write access so that the process's
+// next write to it makes a private copy (see uvmunloan()).
+// Only writable pages mapped by a 4096-byte PTE can be lent.
+// Returns the page's physical address, which the borrower
+// must kfree(), or 0 if it can't be lent.
+uint64
+uvmloan(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa, sz;
+
+  if(va >= MAXVA || (pte = walksize(pagetable, va, &sz)) == 0 || sz != PGSIZE)
+    return 0;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & (PTE_W|PTE_LOAN)) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+  if(kdup((void *)pa) < 0)
+    return 0;
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_LOAN;
+    sfence_vma_va(va);
+  }
+  return pa;
+}
+
+// Handle a write fault at va on a page uvmloan() lent out:
+// copy the page if the borrower still holds it, and make it
+// writable again. Returns 0 if the write can be retried, -1 if
+// va isn't a lent page or there is no memory for the copy.
+int
+uvmunloan(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa, sz;
+  char *mem;
+
+  if(va >= MAXVA || (pte = walksize(pagetable, va, &sz)) == 0 || sz != PGSIZE)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_LOAN) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  if(kshared((void *)pa)){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char *)pa, PGSIZE);
+    *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
+    kfree((void *)pa);
+  }
+  *pte = (*pte & ~PTE_LOAN) | PTE_W;
+  sfence_vma_va(va);
+  return 0;
+}
+
+// Like walkaddr(), but for the kernel to write to the page:
+// make a lent page the process's own again first, and return
+// 0 if the page isn't writable.
+static uint64
+walkaddrw(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 sz;
+
+  if(va >= MAXVA || (pte = walksize(pagetable, va, &sz)) == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if((*pte & PTE_LOAN) && uvmunloan(pagetable, va) < 0)
+    return 0;
+  if((*pte & PTE_W) == 0)
+    return 0;
+  return PTE2PA(*pte) + PGROUNDDOWN(va % sz);
+}
+
+// If pagetable is the current process's, and so the one this
+// CPU is running on, return how many of the len bytes of user
+// memory starting at va the kernel can reach directly. Otherwise
+// 0, and the caller must walk pagetable in software.
+// With SUM set, S-mode can reach pages without PTE_U too, so
+// stop at one, e.g. exec's stack guard page.
+static uint64
+uvmdirect(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 a, sz;
+
+  if(p == 0 || p->pagetable != pagetable || va >= p->sz)
+    return 0;
+  if(len > p->sz - va)
+    len = p->sz - va;
+  for(a = va; a < va + len; a = (a & ~(sz-1)) + sz){
+    pte = walksize(pagetable, a, &sz);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+      return a - va;
+  }
+  return len;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -353,9 +639,12 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(len > 0 && uvmdirect(pagetable, dstva, len) >= len)
+    return copyuser((void *)dstva, src, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkaddrw(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -378,6 +667,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(len > 0 && uvmdirect(pagetable, srcva, len) >= len)
+    return copyuser(dst, (void *)srcva, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -405,6 +697,9 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(max > 0 && (n = uvmdirect(pagetable, srcva, max)) > 0)
+    return copyuserstr(dst, (char *)srcva, n);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
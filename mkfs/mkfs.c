@@ -16,6 +16,7 @@
 #endif
 
 #define NINODES 200
+#define NROOTENT NINODES
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
@@ -40,6 +41,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirinit(uint inum, uint parent, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -68,26 +70,34 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  int i, cc, fd, first;
+  uint rootino, inum, flags;
+  struct dirent de[NROOTENT];
+  int nde;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  // -o: ordered mode, file data isn't logged.
+  flags = 0;
+  first = 1;
+  if(argc > 1 && strcmp(argv[1], "-o") == 0){
+    flags |= SB_ORDERED;
+    first++;
+  }
+
+  if(argc < first + 1){
+    fprintf(stderr, "Usage: mkfs [-o] fs.img files...\n");
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  fsfd = open(argv[first], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
-    die(argv[1]);
+    die(argv[first]);
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
@@ -101,6 +111,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.flags = xint(flags);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -117,21 +128,15 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  nde = 0;
 
-  for(i = 2; i < argc; i++){
-    // get rid of "user/"
+  for(i = first+1; i < argc; i++){
+    // get rid of "user/" or "kernel/"
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
       shortname = argv[i] + 5;
+    else if(strncmp(argv[i], "kernel/", 7) == 0)
+      shortname = argv[i] + 7;
     else
       shortname = argv[i];
     
@@ -149,10 +154,11 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nde < NROOTENT);
+    bzero(&de[nde], sizeof(de[nde]));
+    de[nde].inum = xshort(inum);
+    strncpy(de[nde].name, shortname, DIRSIZ);
+    nde++;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +166,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirinit(rootino, rootino, de, nde);
 
   balloc(freeblock);
 
@@ -293,6 +294,81 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// same as namehash() in kernel/fs.c.
+ushort
+namehash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h ^ (h >> 16);
+}
+
+int
+hashcmp(const void *a, const void *b)
+{
+  return namehash(((struct dirent*)a)->name) - namehash(((struct dirent*)b)->name);
+}
+
+// Write directory inum's contents: ".", "..", and the n
+// entries in de, hashed into leaves as the kernel expects.
+void
+dirinit(uint inum, uint parent, struct dirent *de, int n)
+{
+  struct dirent blk[BSIZE/sizeof(struct dirent)];
+  struct dxent *dx;
+  int first[NDXENT+1];
+  int i, j, k, nleaf, per = BSIZE/sizeof(struct dirent);
+
+  qsort(de, n, sizeof(*de), hashcmp);
+
+  // fill each leaf, but, as the kernel's dxsplit() does, keep
+  // names with the same hash together: a leaf ends before a
+  // run of them that would cross its end.
+  nleaf = 0;
+  for(i = 0; i < n; i = j){
+    if(nleaf == NDXENT){
+      fprintf(stderr, "mkfs: too many names in a directory\n");
+      exit(1);
+    }
+    first[nleaf++] = i;
+    j = min(i + per, n);
+    if(j < n){
+      for(k = j; k > i && namehash(de[k].name) == namehash(de[k-1].name); k--)
+        ;
+      if(k == i){
+        fprintf(stderr, "mkfs: too many names with one hash\n");
+        exit(1);
+      }
+      j = k;
+    }
+  }
+  first[nleaf] = n;
+
+  bzero(blk, sizeof(blk));
+  blk[0].inum = xshort(inum);
+  strcpy(blk[0].name, ".");
+  blk[1].inum = xshort(parent);
+  strcpy(blk[1].name, "..");
+  for(i = 0; i < nleaf; i++){
+    dx = (struct dxent*)blk[DXFIRST + i/DXPERSLOT].name + i%DXPERSLOT;
+    dx->hash = xshort(i == 0 ? 0 : namehash(de[first[i]].name));
+    dx->block = xshort(i + 1);
+  }
+  iappend(inum, blk, BSIZE);
+
+  for(i = 0; i < nleaf; i++){
+    bzero(blk, sizeof(blk));
+    for(j = first[i]; j < first[i+1]; j++)
+      blk[j - first[i]] = de[j];
+    iappend(inum, blk, BSIZE);
+  }
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,187 @@
+// ktrace: trace what the kernel does while a command runs.
+// usage: ktrace command [arg ...]
+// Turns on the kernel's tracepoints (see kernel/trace.h),
+// runs command, and prints the events in time order, with
+// how long each system call, disk request and log commit
+// took. Times are in mtime cycles since the first event.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+#include "user/sysnames.h"
+
+struct traceevent *ev;
+int nev, maxev;
+
+// when each of the last few things started, to say how long they took.
+#define NSTART 64
+struct start {
+  int type;
+  uint key;
+  uint64 time;
+} starts[NSTART];
+int nextstart;
+
+void
+die(char *s)
+{
+  fprintf(2, "ktrace: %s\n", s);
+  exit(1);
+}
+
+void
+started(int type, uint key, uint64 time)
+{
+  starts[nextstart].type = type;
+  starts[nextstart].key = key;
+  starts[nextstart].time = time;
+  nextstart = (nextstart + 1) % NSTART;
+}
+
+// How long since the matching started(), or 0 if forgotten.
+uint64
+took(int type, uint key, uint64 time)
+{
+  int i;
+
+  for(i = 0; i < NSTART; i++){
+    if(starts[i].type == type && starts[i].key == key){
+      starts[i].type = 0;
+      return time - starts[i].time;
+    }
+  }
+  return 0;
+}
+
+char*
+sysname(uint num)
+{
+  if(num < sizeof(sysnames)/sizeof(sysnames[0]) && sysnames[num])
+    return sysnames[num];
+  return "?";
+}
+
+void
+show(struct traceevent *e, uint64 t0)
+{
+  printf("%l\tcpu%d\tpid %d\t", e->time - t0, e->cpu, e->pid);
+  switch(e->type){
+  case TR_SYSCALL:
+    started(TR_SYSCALL, e->pid, e->time);
+    printf("%s\n", sysname(e->a));
+    break;
+  case TR_SYSRET:
+    printf("%s = %d (%l)\n", sysname(e->a), (int)e->b, took(TR_SYSCALL, e->pid, e->time));
+    break;
+  case TR_SWITCH:
+    if(e->a)
+      printf("switch to pid %d\n", e->a);
+    else
+      printf("switch from pid %d\n", e->b);
+    break;
+  case TR_BREAD:
+    printf("bread %d (miss)\n", e->a);
+    break;
+  case TR_BREADHIT:
+    printf("bread %d (hit)\n", e->a);
+    break;
+  case TR_BWRITE:
+    printf("bwrite %d\n", e->a);
+    break;
+  case TR_DISKSUBMIT:
+    started(TR_DISKSUBMIT, e->a, e->time);
+    printf("disk %s %d\n", e->b ? "write" : "read", e->a);
+    break;
+  case TR_DISKDONE:
+    printf("disk done %d (%l)\n", e->a, took(TR_DISKSUBMIT, e->a, e->time));
+    break;
+  case TR_COMMIT:
+    started(TR_COMMIT, 0, e->time);
+    printf("commit %d blocks\n", e->a);
+    break;
+  case TR_COMMITDONE:
+    printf("commit done (%l)\n", took(TR_COMMIT, 0, e->time));
+    break;
+  default:
+    printf("event %d %d %d\n", e->type, e->a, e->b);
+  }
+}
+
+// Shell sort, by time; each hart's events are in order already.
+void
+sortevents(void)
+{
+  int gap, i, j;
+  struct traceevent t;
+
+  for(gap = nev/2; gap > 0; gap /= 2){
+    for(i = gap; i < nev; i++){
+      t = ev[i];
+      for(j = i; j >= gap && ev[j-gap].time > t.time; j -= gap)
+        ev[j] = ev[j-gap];
+      ev[j] = t;
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, n, i;
+
+  if(argc < 2){
+    fprintf(2, "usage: ktrace command [arg ...]\n");
+    exit(1);
+  }
+  if((fd = open("/trace", O_RDWR)) < 0)
+    die("cannot open /trace");
+
+  if(write(fd, "1", 1) != 1)
+    die("cannot start tracing");
+  if((pid = fork()) < 0)
+    die("fork failed");
+  if(pid == 0){
+    // stop tracing once the command is done,
+    // so that our reader sees the end.
+    if((pid = fork()) == 0){
+      exec(argv[1], argv+1);
+      fprintf(2, "ktrace: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    if(pid > 0)
+      wait(0);
+    write(fd, "0", 1);
+    exit(0);
+  }
+
+  for(;;){
+    if(nev == maxev){
+      struct traceevent *nv;
+      maxev = maxev ? 2*maxev : 1024;
+      if((nv = malloc(maxev * sizeof(*nv))) == 0){
+        write(fd, "0", 1);
+        die("out of memory");
+      }
+      memmove(nv, ev, nev * sizeof(*nv));
+      free(ev);
+      ev = nv;
+    }
+    n = read(fd, ev + nev, (maxev - nev) * sizeof(*ev));
+    if(n < 0){
+      write(fd, "0", 1);
+      die("read failed");
+    }
+    if(n == 0)
+      break;
+    nev += n / sizeof(*ev);
+  }
+  wait(0);
+  close(fd);
+
+  sortevents();
+  for(i = 0; i < nev; i++)
+    show(&ev[i], ev[0].time);
+  exit(0);
+}
@@ -0,0 +1,79 @@
+// lockbench: compare kernel locks under contention.
+// For 1, 2, ... harts, runs one process pinned to each,
+// all taking the same kernel lock (see kernel/lockbench.c)
+// at once, and reports how long they took.
+//   tas:    test-and-set spinlock
+//   ticket: ticket spinlock, as acquire() is now
+//   sleep:  sleeplock that sleeps at once
+//   adapt:  sleeplock that spins while its owner runs
+// usage: lockbench [n], where n is acquisitions per process.
+// Boot with make CPUS=8 qemu to try up to 8 harts.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+char *kinds[] = { "tas", "ticket", "sleep", "adapt" };
+
+// Run kind on the first ncpu CPUs of mask; return ticks taken.
+int
+run(int kind, int mask, int ncpu, int n)
+{
+  int fds[2], i, cpu, t0, xstatus, ok = 1;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("lockbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0, cpu = 0; i < ncpu; i++, cpu++){
+    while((mask & (1 << cpu)) == 0)
+      cpu++;
+    if(fork() == 0){
+      close(fds[1]);
+      if(setaffinity(0, 1 << cpu) < 0 || read(fds[0], &c, 1) != 1)
+        exit(1);
+      exit(lockbench(kind, n) < 0);
+    }
+  }
+  close(fds[0]);
+  // start them all at once.
+  t0 = uptime();
+  for(i = 0; i < ncpu; i++)
+    write(fds[1], "x", 1);
+  close(fds[1]);
+  for(i = 0; i < ncpu; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  if(!ok){
+    printf("lockbench: %s failed\n", kinds[kind]);
+    exit(1);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000, mask, ncpu, i, kind;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  mask = getaffinity(0);
+  for(ncpu = 0, i = 0; i < 32; i++)
+    if(mask & (1 << i))
+      ncpu++;
+
+  printf("harts");
+  for(kind = 0; kind < 4; kind++)
+    printf("\t%s", kinds[kind]);
+  printf("\t(ticks for %d acquisitions per hart)\n", n);
+  for(i = 1; i <= ncpu; i++){
+    printf("%d", i);
+    for(kind = 0; kind < 4; kind++)
+      printf("\t%d", run(kind, mask, i, n));
+    printf("\n");
+  }
+  exit(0);
+}
@@ -0,0 +1,101 @@
+// lockstat: show which kernel locks are contended.
+// usage: lockstat [-t] [-n count] [command [arg ...]]
+//        lockstat -on | -off
+// With a command, counts only what happens while it runs,
+// turning counting on for it if need be; without, everything
+// counted since it was turned on with -on. Lists the count
+// classes of lock (10 by default) most often contended, or
+// with -t those held longest.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockstat before[NLOCKCLASS], after[NLOCKCLASS];
+int order[NLOCKCLASS];
+
+void
+usage(void)
+{
+  fprintf(2, "usage: lockstat [-t] [-n count] [command [arg ...]]\n");
+  fprintf(2, "       lockstat -on | -off\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, k, n, nb, count = 10, bytime = 0, was, pid;
+  struct lockstat *s;
+  uint64 ki, kj;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-on") == 0 || strcmp(argv[i], "-off") == 0){
+      if(argc != 2)
+        usage();
+      lockcount(argv[i][2] == 'n');
+      exit(0);
+    } else if(strcmp(argv[i], "-t") == 0)
+      bytime = 1;
+    else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      count = atoi(argv[++i]);
+    else
+      usage();
+  }
+
+  nb = 0;
+  if(i < argc){
+    was = lockcount(1);
+    if((nb = lockstat(before, NLOCKCLASS)) < 0){
+      fprintf(2, "lockstat: lockstat failed\n");
+      exit(1);
+    }
+    if((pid = fork()) < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[i], argv+i);
+      fprintf(2, "lockstat: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    wait(0);
+    lockcount(was);
+  }
+  if((n = lockstat(after, NLOCKCLASS)) < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+
+  // classes are only ever added, at the end.
+  for(i = 0; i < nb; i++){
+    after[i].acquires -= before[i].acquires;
+    after[i].contended -= before[i].contended;
+    after[i].spins -= before[i].spins;
+    after[i].hold -= before[i].hold;
+  }
+
+  // insertion sort, most contended (or longest held) first.
+  for(i = 0; i < n; i++){
+    ki = bytime ? after[i].hold : after[i].contended;
+    for(j = i; j > 0; j--){
+      k = order[j-1];
+      kj = bytime ? after[k].hold : after[k].contended;
+      if(kj >= ki)
+        break;
+      order[j] = k;
+    }
+    order[j] = i;
+  }
+
+  printf("%s\t%s\t%s\t%s\t%s\n", "acquires", "contended", "spins", "hold", "lock");
+  for(i = 0; i < n && i < count; i++){
+    s = &after[order[i]];
+    if(s->acquires == 0)
+      continue;
+    printf("%l\t%l\t%l\t%l\t%s%s\n", s->acquires, s->contended, s->spins,
+           s->hold, s->name, s->sleep ? " (sleep)" : "");
+  }
+  exit(0);
+}
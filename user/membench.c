@@ -0,0 +1,89 @@
+// membench: time kernel paths that spend most of their time
+// filling or copying memory, as a benchmark for memset() and
+// memmove() in kernel/string.c.
+//   fill:  grow and shrink memory with sbrk(); the kernel fills
+//          each page in kalloc(), uvmalloc() and kfree().
+//   fork:  fork a large process; uvmcopy() copies each page.
+//   write: write a file; the buffer cache and log copy blocks.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define MB (1024*1024)
+
+void
+fill(int mb, int rounds)
+{
+  int t0 = uptime();
+  for(int i = 0; i < rounds; i++){
+    if(sbrk(mb*MB) == (char*)-1){
+      printf("membench: sbrk failed\n");
+      exit(1);
+    }
+    sbrk(-mb*MB);
+  }
+  printf("fill:  %d MB in %d ticks\n", mb*rounds, uptime() - t0);
+}
+
+void
+forks(int mb, int rounds)
+{
+  char *p = sbrk(mb*MB);
+
+  if(p == (char*)-1){
+    printf("membench: sbrk failed\n");
+    exit(1);
+  }
+  int t0 = uptime();
+  for(int i = 0; i < rounds; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("membench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  printf("fork:  %d MB in %d ticks\n", mb*rounds, uptime() - t0);
+  sbrk(-mb*MB);
+}
+
+void
+writes(int blocks, int rounds)
+{
+  static char buf[1024];
+
+  memset(buf, 'x', sizeof(buf));
+  int t0 = uptime();
+  for(int i = 0; i < rounds; i++){
+    int fd = open("membench.tmp", O_CREATE|O_WRONLY|O_TRUNC);
+    if(fd < 0){
+      printf("membench: open failed\n");
+      exit(1);
+    }
+    for(int b = 0; b < blocks; b++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("membench: write failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  unlink("membench.tmp");
+  printf("write: %d KB in %d ticks\n", blocks*rounds, uptime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 20;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  fill(4, rounds);
+  forks(4, rounds);
+  writes(200, rounds / 4 + 1);
+  exit(0);
+}
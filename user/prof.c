@@ -0,0 +1,264 @@
+// prof: a sampling profiler.
+// usage: prof [-n count] command [arg ...]
+// Runs command with the kernel's profiler on, then prints a
+// flat profile: the count functions (20 by default) in which
+// most samples landed, kernel or user, named from /kernel.sym
+// and each program's own .sym file in /.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+// a symbol table, from a .sym file, and its samples.
+struct symtab {
+  char name[16];     // "kernel", or the program's name
+  int user;
+  int n;             // symbols
+  uint64 *addr;      // sorted
+  char **sym;
+  int *hits;         // samples per symbol
+  int miss;          // samples before the first symbol
+};
+
+#define NTAB 16
+struct symtab tabs[NTAB];
+int ntab;
+
+struct profsample *samples;
+int nsamples, maxsamples;
+
+void
+die(char *s)
+{
+  fprintf(2, "prof: %s\n", s);
+  exit(1);
+}
+
+uint64
+hex(char *s)
+{
+  uint64 x = 0;
+
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      x = x*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      x = x*16 + *s - 'a' + 10;
+    else
+      return x;
+  }
+}
+
+// Could name be a function? Rules out section and
+// source file names, and the assembler's local labels.
+int
+isfunc(char *name)
+{
+  int n = strlen(name);
+
+  if(n == 0 || name[0] == '.' || name[0] == '$')
+    return 0;
+  if(n > 2 && name[n-2] == '.' && (name[n-1] == 'c' || name[n-1] == 'S'))
+    return 0;
+  return 1;
+}
+
+// Read a .sym file, whose lines are "address name".
+void
+loadsyms(struct symtab *t, char *file)
+{
+  struct stat st;
+  char *buf, *p, *q, *sp;
+  int fd, i, max;
+
+  t->n = 0;
+  if((fd = open(file, O_RDONLY)) < 0)
+    return;
+  if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0)
+    die("out of memory");
+  if(read(fd, buf, st.size) != st.size)
+    die("cannot read symbols");
+  close(fd);
+  buf[st.size] = 0;
+
+  for(max = 0, p = buf; *p; p++)
+    if(*p == '\n')
+      max++;
+  t->addr = malloc(max * sizeof(uint64));
+  t->sym = malloc(max * sizeof(char*));
+  if(t->addr == 0 || t->sym == 0)
+    die("out of memory");
+
+  for(p = buf; *p; p = q){
+    for(q = p; *q && *q != '\n'; q++)
+      ;
+    if(*q)
+      *q++ = 0;
+    if((sp = strchr(p, ' ')) == 0)
+      continue;
+    sp++;
+    if(!isfunc(sp))
+      continue;
+    // insert, keeping addresses sorted.
+    for(i = t->n; i > 0 && t->addr[i-1] > hex(p); i--){
+      t->addr[i] = t->addr[i-1];
+      t->sym[i] = t->sym[i-1];
+    }
+    t->addr[i] = hex(p);
+    t->sym[i] = sp;
+    t->n++;
+  }
+  if((t->hits = malloc((t->n + 1) * sizeof(int))) == 0)
+    die("out of memory");
+  memset(t->hits, 0, (t->n + 1) * sizeof(int));
+}
+
+struct symtab*
+findtab(int user, char *name)
+{
+  struct symtab *t;
+  char file[32];
+
+  if(!user)
+    name = "kernel";
+  for(t = tabs; t < &tabs[ntab]; t++)
+    if(t->user == user && strcmp(t->name, name) == 0)
+      return t;
+  if(ntab == NTAB)
+    return 0;
+  t = &tabs[ntab++];
+  strcpy(t->name, name);
+  t->user = user;
+  strcpy(file, "/");
+  strcpy(file + 1, name);
+  strcpy(file + strlen(file), ".sym");
+  loadsyms(t, file);
+  return t;
+}
+
+// Count sample s against the symbol it landed in.
+void
+count(struct profsample *s)
+{
+  struct symtab *t;
+  int lo, hi, mid;
+
+  if((t = findtab(s->user, s->name)) == 0)
+    return;
+  // find the last symbol at or below s->pc.
+  lo = 0;
+  hi = t->n;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(t->addr[mid] <= s->pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo == 0)
+    t->miss++;
+  else
+    t->hits[lo-1]++;
+}
+
+void
+run(char **argv)
+{
+  int pid;
+
+  profile(1);
+  if((pid = fork()) < 0)
+    die("fork failed");
+  if(pid == 0){
+    // stop profiling once the command is done,
+    // so that our reader sees the end.
+    if((pid = fork()) < 0){
+      profile(0);
+      die("fork failed");
+    }
+    if(pid == 0){
+      exec(argv[0], argv);
+      fprintf(2, "prof: exec %s failed\n", argv[0]);
+      exit(1);
+    }
+    wait(0);
+    profile(0);
+    exit(0);
+  }
+
+  for(;;){
+    if(nsamples == maxsamples){
+      struct profsample *ns;
+      maxsamples = maxsamples ? 2*maxsamples : 1024;
+      if((ns = malloc(maxsamples * sizeof(*ns))) == 0){
+        profile(0);
+        die("out of memory");
+      }
+      memmove(ns, samples, nsamples * sizeof(*ns));
+      free(samples);
+      samples = ns;
+    }
+    int n = profread(samples + nsamples, maxsamples - nsamples);
+    if(n < 0){
+      profile(0);
+      die("profread failed");
+    }
+    if(n == 0)
+      break;
+    nsamples += n;
+  }
+  wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct symtab *t, *bt;
+  int i, j, top = 20, best, bi, c;
+
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    i = 3;
+  }
+  if(i >= argc){
+    fprintf(2, "usage: prof [-n count] command [arg ...]\n");
+    exit(1);
+  }
+
+  run(argv + i);
+  for(i = 0; i < nsamples; i++)
+    count(&samples[i]);
+
+  printf("%d samples\n", nsamples);
+  if(nsamples == 0)
+    exit(0);
+  printf("samples\t%%\tfunction\n");
+  // repeatedly pick out the symbol with the most samples.
+  for(j = 0; j < top; j++){
+    best = 0;
+    bt = 0;
+    bi = 0;
+    for(t = tabs; t < &tabs[ntab]; t++){
+      for(i = -1; i < t->n; i++){
+        c = i < 0 ? t->miss : t->hits[i];
+        if(c > best){
+          best = c;
+          bt = t;
+          bi = i;
+        }
+      }
+    }
+    if(bt == 0)
+      break;
+    printf("%d\t%d\t%s [%s]\n", best, best * 100 / nsamples,
+           bi < 0 ? "?" : bt->sym[bi], bt->name);
+    if(bi < 0)
+      bt->miss = 0;
+    else
+      bt->hits[bi] = 0;
+  }
+  exit(0);
+}
@@ -0,0 +1,42 @@
+// Names of system calls, indexed by number, for the tools
+// that show them. Include kernel/syscall.h first.
+static char *sysnames[] = {
+[SYS_fork]        "fork",
+[SYS_exit]        "exit",
+[SYS_wait]        "wait",
+[SYS_pipe]        "pipe",
+[SYS_read]        "read",
+[SYS_kill]        "kill",
+[SYS_exec]        "exec",
+[SYS_fstat]       "fstat",
+[SYS_chdir]       "chdir",
+[SYS_dup]         "dup",
+[SYS_getpid]      "getpid",
+[SYS_sbrk]        "sbrk",
+[SYS_sleep]       "sleep",
+[SYS_uptime]      "uptime",
+[SYS_open]        "open",
+[SYS_write]       "write",
+[SYS_mknod]       "mknod",
+[SYS_unlink]      "unlink",
+[SYS_link]        "link",
+[SYS_mkdir]       "mkdir",
+[SYS_close]       "close",
+[SYS_setaffinity] "setaffinity",
+[SYS_getaffinity] "getaffinity",
+[SYS_splice]      "splice",
+[SYS_readv]       "readv",
+[SYS_writev]      "writev",
+[SYS_pread]       "pread",
+[SYS_pwrite]      "pwrite",
+[SYS_iosubmit]    "iosubmit",
+[SYS_getdents]    "getdents",
+[SYS_lockbench]   "lockbench",
+[SYS_lockstat]    "lockstat",
+[SYS_profile]     "profile",
+[SYS_profread]    "profread",
+[SYS_procstat]    "procstat",
+[SYS_syscount]    "syscount",
+[SYS_sysstat]     "sysstat",
+[SYS_lockcount]   "lockcount",
+};
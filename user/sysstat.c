@@ -0,0 +1,143 @@
+// sysstat: show which system calls are made, and how long they take.
+// usage: sysstat [-t] [-h] [-n count] [command [arg ...]]
+//        sysstat -on | -off
+// With a command, counts only what happens while it runs,
+// turning counting on for it if need be; without, everything
+// counted since it was turned on with -on. Lists the count
+// system calls (10 by default) most often made, or with -t
+// those that took longest in all, with times in mtime cycles;
+// -h adds a histogram of each one's latencies.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+#include "user/sysnames.h"
+
+#define NSYS 64
+
+struct sysstat before[NSYS], after[NSYS];
+int order[NSYS];
+
+void
+usage(void)
+{
+  fprintf(2, "usage: sysstat [-t] [-h] [-n count] [command [arg ...]]\n");
+  fprintf(2, "       sysstat -on | -off\n");
+  exit(1);
+}
+
+void
+histogram(struct sysstat *s)
+{
+  int i, j, lo, hi, bar;
+  uint most;
+
+  lo = NSYSHIST;
+  hi = -1;
+  most = 0;
+  for(i = 0; i < NSYSHIST; i++){
+    if(s->hist[i] == 0)
+      continue;
+    if(lo == NSYSHIST)
+      lo = i;
+    hi = i;
+    if(s->hist[i] > most)
+      most = s->hist[i];
+  }
+  for(i = lo; i <= hi; i++){
+    printf("\t%l-%l\t%d\t", i ? 1L << i : 0L, (1L << (i+1)) - 1, s->hist[i]);
+    bar = (s->hist[i] * 40 + most - 1) / most;
+    for(j = 0; j < bar; j++)
+      printf("*");
+    printf("\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, k, n, nb, count = 10, bytime = 0, hist = 0, was, pid;
+  struct sysstat *s;
+  uint64 ki, kj;
+  char *name;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-on") == 0 || strcmp(argv[i], "-off") == 0){
+      if(argc != 2)
+        usage();
+      syscount(argv[i][2] == 'n');
+      exit(0);
+    } else if(strcmp(argv[i], "-t") == 0)
+      bytime = 1;
+    else if(strcmp(argv[i], "-h") == 0)
+      hist = 1;
+    else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      count = atoi(argv[++i]);
+    else
+      usage();
+  }
+
+  nb = 0;
+  if(i < argc){
+    was = syscount(1);
+    if((nb = sysstat(before, NSYS)) < 0){
+      fprintf(2, "sysstat: sysstat failed\n");
+      exit(1);
+    }
+    if((pid = fork()) < 0){
+      fprintf(2, "sysstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[i], argv+i);
+      fprintf(2, "sysstat: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    wait(0);
+    syscount(was);
+  }
+  if((n = sysstat(after, NSYS)) < 0){
+    fprintf(2, "sysstat: sysstat failed\n");
+    exit(1);
+  }
+
+  // the longest call overall stands in for the longest
+  // while the command ran.
+  for(i = 0; i < nb; i++){
+    after[i].count -= before[i].count;
+    after[i].time -= before[i].time;
+    for(j = 0; j < NSYSHIST; j++)
+      after[i].hist[j] -= before[i].hist[j];
+  }
+
+  // insertion sort, most often called (or longest in all) first.
+  for(i = 0; i < n; i++){
+    ki = bytime ? after[i].time : after[i].count;
+    for(j = i; j > 0; j--){
+      k = order[j-1];
+      kj = bytime ? after[k].time : after[k].count;
+      if(kj >= ki)
+        break;
+      order[j] = k;
+    }
+    order[j] = i;
+  }
+
+  printf("%s\t%s\t%s\t%s\t%s\n", "calls", "time", "avg", "max", "syscall");
+  for(i = 0; i < n && i < count; i++){
+    s = &after[order[i]];
+    if(s->count == 0)
+      continue;
+    name = order[i] < sizeof(sysnames)/sizeof(sysnames[0]) ? sysnames[order[i]] : 0;
+    printf("%l\t%l\t%l\t%l\t", s->count, s->time, s->time / s->count, s->max);
+    if(name)
+      printf("%s\n", name);
+    else
+      printf("%d\n", order[i]);
+    if(hist)
+      histogram(s);
+  }
+  exit(0);
+}
@@ -0,0 +1,110 @@
+// top: show what the processes are doing.
+// usage: top [-n count] [-d ticks]
+// Every ticks clock ticks (10 by default), count times
+// (5 by default), lists each process, busiest first: the
+// share of a CPU it had since the last list, its user and
+// kernel time in ms, context switches it made (v) and was
+// made to make (iv), page faults, disk blocks read and
+// written, system calls, and memory in KB.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/pstat.h"
+#include "user/user.h"
+
+// a clock tick is 1/10th second in qemu.
+#define MS(cycles) ((cycles) / (TICKCYCLES / 100))
+
+struct pstat *cur, *prev;
+int ncur, nprev;
+int order[MAXPROC];
+uint64 busy[MAXPROC];  // cycles run since the last list
+
+int
+snapshot(void)
+{
+  int n;
+
+  if((n = procstat(cur, MAXPROC)) < 0){
+    fprintf(2, "top: procstat failed\n");
+    exit(1);
+  }
+  return n;
+}
+
+void
+show(int ticks)
+{
+  struct pstat *p, *q;
+  uint64 elapsed = (uint64)ticks * TICKCYCLES;
+  int i, j, k;
+
+  for(i = 0; i < ncur; i++){
+    p = &cur[i];
+    busy[i] = p->utime + p->stime;
+    for(q = prev; q < &prev[nprev]; q++){
+      if(q->pid == p->pid){
+        busy[i] -= q->utime + q->stime;
+        break;
+      }
+    }
+    // insertion sort, busiest first.
+    for(j = i; j > 0 && busy[order[j-1]] < busy[i]; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  printf("\033[H\033[J%d processes, up %d ticks\n", ncur, uptime());
+  printf("PID\tPPID\tSTATE\t%%CPU\tUSER\tSYS\tV\tIV\tFLT\tRD\tWR\tSYSC\tKB\tNAME\n");
+  for(i = 0; i < ncur; i++){
+    k = order[i];
+    p = &cur[k];
+    printf("%d\t%d\t%s\t%l\t%l\t%l\t%l\t%l\t%l\t%l\t%l\t%l\t%l\t%s\n",
+           p->pid, p->ppid, p->state,
+           elapsed ? busy[k] * 100 / elapsed : 0,
+           MS(p->utime), MS(p->stime), p->vcsw, p->ivcsw, p->faults,
+           p->rblocks, p->wblocks, p->syscalls, p->sz / 1024, p->name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, count = 5, delay = 10, t0, t1;
+  struct pstat *t;
+
+  for(i = 1; i + 1 < argc; i += 2){
+    if(strcmp(argv[i], "-n") == 0)
+      count = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-d") == 0)
+      delay = atoi(argv[i+1]);
+    else
+      break;
+  }
+  if(i != argc || delay < 1){
+    fprintf(2, "usage: top [-n count] [-d ticks]\n");
+    exit(1);
+  }
+
+  cur = malloc(MAXPROC * sizeof(struct pstat));
+  prev = malloc(MAXPROC * sizeof(struct pstat));
+  if(cur == 0 || prev == 0){
+    fprintf(2, "top: out of memory\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  ncur = snapshot();
+  for(i = 0; i < count; i++){
+    sleep(delay);
+    t = prev;
+    prev = cur;
+    cur = t;
+    nprev = ncur;
+    ncur = snapshot();
+    t1 = uptime();
+    show(t1 - t0);
+    t0 = t1;
+  }
+  exit(0);
+}
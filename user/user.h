@@ -1,4 +1,11 @@
 struct stat;
+struct iovec;
+struct ioring;
+struct dirent;
+struct lockstat;
+struct profsample;
+struct pstat;
+struct sysstat;
 
 // system calls
 int fork(void);
@@ -22,6 +29,23 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setaffinity(int, int);
+int getaffinity(int);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int iosubmit(struct ioring*);
+int getdents(int, struct dirent*, int);
+int lockbench(int, int);
+int lockstat(struct lockstat*, int);
+int profile(int);
+int profread(struct profsample*, int);
+int procstat(struct pstat*, int);
+int syscount(int);
+int sysstat(struct sysstat*, int);
+int lockcount(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
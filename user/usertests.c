@@ -4,6 +4,12 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/ioring.h"
+#include "kernel/lockstat.h"
+#include "kernel/prof.h"
+#include "kernel/trace.h"
+#include "kernel/pstat.h"
+#include "kernel/sysstat.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -786,6 +792,582 @@ pipe1(char *s)
 }
 
 
+// writes of whole, aligned pages are lent to the pipe rather than
+// copied. the writer changing its buffer afterwards, or reading
+// the pipe back into it, must not change what the pipe delivers.
+void
+pipeloan(char *s)
+{
+  int fds[2], pid, xstatus, n, i;
+  char *buf;
+
+  buf = sbrk(3*PGSIZE);
+  buf = (char*)(((uint64)buf + PGSIZE - 1) & ~(PGSIZE - 1));
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  memset(buf, 'a', 2*PGSIZE);
+  if(write(fds[1], buf, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'b', PGSIZE);
+  for(i = 0; i < 2*PGSIZE; i += n){
+    if((n = read(fds[0], buf + i, 2*PGSIZE - i)) <= 0){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 2*PGSIZE; i++){
+    if(buf[i] != 'a'){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // the same, with the reader in another process.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    for(i = 0; i < 2*PGSIZE; i += n){
+      if((n = read(fds[0], buf + i, 2*PGSIZE - i)) <= 0){
+        printf("%s: child read failed\n", s);
+        exit(1);
+      }
+    }
+    for(i = 0; i < 2*PGSIZE; i++){
+      if(buf[i] != 'c'){
+        printf("%s: child got wrong data at %d\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  memset(buf, 'c', 2*PGSIZE);
+  if(write(fds[1], buf, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'd', 2*PGSIZE);
+  close(fds[1]);
+  wait(&xstatus);
+  exit(xstatus);
+}
+
+// a read() that starts in a page lent to a pipe but runs past
+// the end of memory must fail without changing the pipe's data.
+void
+pipeloanread(char *s)
+{
+  int fds[2], fd, i;
+  char *cur, *buf;
+
+  cur = sbrk(0);
+  sbrk(PGROUNDUP((uint64)cur) - (uint64)cur + PGSIZE);
+  buf = (char*)PGROUNDUP((uint64)cur);
+  if(buf + PGSIZE != sbrk(0)){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'a', PGSIZE);
+  if(write(fds[1], buf, PGSIZE) != PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if(read(fd, buf + PGSIZE - 10, 20) != -1){
+    printf("%s: read past the end of memory succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(buf, 'b', PGSIZE);
+  if(read(fds[0], buf, PGSIZE) != PGSIZE){
+    printf("%s: pipe read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < PGSIZE; i++){
+    if(buf[i] != 'a'){
+      printf("%s: pipe data changed at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// splice() between files and pipes.
+void
+splicetest(char *s)
+{
+  enum { SZ=3000 };
+  int fd, fd2, fds[2], i, n, tot;
+  static char data[SZ], got[SZ];
+
+  for(i = 0; i < SZ; i++)
+    data[i] = 'a' + i % 23;
+  unlink("splice1");
+  unlink("splice2");
+  fd = open("splice1", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, SZ) != SZ){
+    printf("%s: create splice1 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // file to file.
+  fd = open("splice1", O_RDONLY);
+  fd2 = open("splice2", O_CREATE|O_RDWR);
+  if(fd < 0 || fd2 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(tot = 0; (n = splice(fd, fd2, 1000)) > 0; tot += n)
+    ;
+  if(n < 0 || tot != SZ){
+    printf("%s: file splice moved %d, returned %d\n", s, tot, n);
+    exit(1);
+  }
+  if(splice(fd2, fd2, 10) != -1){
+    printf("%s: spliced a file to itself\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fd2);
+
+  // file to pipe, pipe to file.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd = open("splice2", O_RDONLY);
+  if(splice(fd, fds[1], SZ) != SZ){
+    printf("%s: splice to pipe failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[1]);
+  unlink("splice1");
+  fd = open("splice1", O_CREATE|O_RDWR);
+  for(tot = 0; (n = splice(fds[0], fd, SZ)) > 0; tot += n)
+    ;
+  close(fds[0]);
+  close(fd);
+  if(n < 0 || tot != SZ){
+    printf("%s: splice from pipe moved %d, returned %d\n", s, tot, n);
+    exit(1);
+  }
+
+  fd = open("splice1", O_RDONLY);
+  if(read(fd, got, SZ) != SZ || memcmp(data, got, SZ) != 0){
+    printf("%s: wrong data after splices\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("splice1");
+  unlink("splice2");
+}
+
+// splice() more than a page from a pipe into a file.
+void
+splicebig(char *s)
+{
+  enum { SZ=12000 };
+  int fd, fds[2], i, n, tot;
+  static char data[SZ], got[SZ];
+
+  for(i = 0; i < SZ; i++)
+    data[i] = 'a' + i % 19;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], data, SZ) != SZ){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  unlink("splicebig");
+  fd = open("splicebig", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(tot = 0; (n = splice(fds[0], fd, 65536)) > 0; tot += n)
+    ;
+  close(fds[0]);
+  close(fd);
+  if(n < 0 || tot != SZ){
+    printf("%s: splice from pipe moved %d, returned %d\n", s, tot, n);
+    exit(1);
+  }
+  fd = open("splicebig", O_RDONLY);
+  if(read(fd, got, SZ) != SZ || memcmp(data, got, SZ) != 0){
+    printf("%s: wrong data after splice\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("splicebig");
+}
+
+// two processes splicing from one shared file offset
+// must between them send each byte exactly once.
+void
+spliceshared(char *s)
+{
+  enum { SZ=20000 };
+  int fd, fds[2], i, j, n, tot, sum, want, xstatus;
+  static char buf[SZ];
+
+  want = 0;
+  for(i = 0; i < SZ; i++){
+    buf[i] = i % 251;
+    want += buf[i];
+  }
+  unlink("spliceshared");
+  fd = open("spliceshared", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("spliceshared", O_RDONLY);
+  if(fd < 0 || pipe(fds) < 0){
+    printf("%s: open or pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2; i++){
+    if(fork() == 0){
+      close(fds[0]);
+      while((n = splice(fd, fds[1], 700)) > 0)
+        ;
+      exit(n < 0);
+    }
+  }
+  close(fd);
+  close(fds[1]);
+  tot = sum = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(j = 0; j < n; j++)
+      sum += buf[j];
+    tot += n;
+  }
+  close(fds[0]);
+  for(i = 0; i < 2; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: splice failed\n", s);
+      exit(1);
+    }
+  }
+  if(tot != SZ || sum != want){
+    printf("%s: got %d bytes, sum %d, not %d and %d\n", s, tot, sum, SZ, want);
+    exit(1);
+  }
+  unlink("spliceshared");
+}
+
+// readv(), writev(), pread() and pwrite().
+void
+vectorio(char *s)
+{
+  char a[10], b[3000], c[7], got[3017];
+  struct iovec iov[3];
+  int fd, i;
+
+  memset(a, 'a', sizeof(a));
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i % 251;
+  memset(c, 'c', sizeof(c));
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+
+  unlink("vectorio");
+  fd = open("vectorio", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(writev(fd, iov, 3) != sizeof(got)){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+
+  // pread doesn't move the offset, which is now at the end.
+  if(pread(fd, got, sizeof(got), 0) != sizeof(got) ||
+     memcmp(got, a, sizeof(a)) != 0 ||
+     memcmp(got + sizeof(a), b, sizeof(b)) != 0 ||
+     memcmp(got + sizeof(a) + sizeof(b), c, sizeof(c)) != 0){
+    printf("%s: pread got wrong data\n", s);
+    exit(1);
+  }
+  if(read(fd, got, 1) != 0){
+    printf("%s: pread moved the offset\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "xyz", 3, 5) != 3 || pwrite(fd, "x", 1, 100000) != -1){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // readv stops at the end of the file.
+  fd = open("vectorio", O_RDONLY);
+  memset(got, 0, sizeof(got));
+  iov[2].iov_base = got;
+  iov[2].iov_len = sizeof(got);
+  if(readv(fd, iov, 3) != sizeof(got) ||
+     memcmp(a, "aaaaaxyzaa", sizeof(a)) != 0 ||
+     b[sizeof(b) - 1] != (sizeof(b) - 1) % 251 ||
+     memcmp(got, c, sizeof(c)) != 0){
+    printf("%s: readv got wrong data\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, IOV_MAX + 1) != -1){
+    printf("%s: readv took too many buffers\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("vectorio");
+}
+
+static void
+ioqueue(struct ioring *r, int op, int fd, void *addr, int len, int off)
+{
+  struct iosqe *e = &r->sq[r->sqtail % IORING_SIZE];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->len = len;
+  e->off = off;
+  e->data = r->sqtail;
+  r->sqtail++;
+}
+
+// batches of system calls through iosubmit().
+void
+ioringtest(char *s)
+{
+  static struct ioring r;
+  struct stat st;
+  char buf[16];
+  int fd, i;
+
+  unlink("ioring");
+  ioqueue(&r, IO_OPEN, 0, "ioring", O_CREATE|O_RDWR, 0);
+  if(iosubmit(&r) != 1 || r.cqtail != 1 || (fd = r.cq[0].res) < 0){
+    printf("%s: open through ring failed\n", s);
+    exit(1);
+  }
+  r.cqhead = r.cqtail;
+
+  ioqueue(&r, IO_WRITE, fd, "hello world", 11, -1);
+  ioqueue(&r, IO_WRITE, fd, "W", 1, 6);
+  ioqueue(&r, IO_FSTAT, fd, &st, 0, 0);
+  ioqueue(&r, IO_READ, fd, buf, sizeof(buf), 0);
+  ioqueue(&r, IO_CLOSE, fd, 0, 0, 0);
+  ioqueue(&r, IO_CLOSE, fd, 0, 0, 0);
+  if(iosubmit(&r) != 6 || r.sqhead != r.sqtail || r.cqtail != 7){
+    printf("%s: iosubmit didn't do the whole batch\n", s);
+    exit(1);
+  }
+  int want[] = { 11, 1, 0, 11, 0, -1 };
+  for(i = 0; i < 6; i++){
+    struct iocqe *c = &r.cq[(r.cqhead + i) % IORING_SIZE];
+    if(c->data != 1 + i || c->res != want[i]){
+      printf("%s: completion %d: data %d res %d\n", s, i, (int)c->data, c->res);
+      exit(1);
+    }
+  }
+  r.cqhead = r.cqtail;
+  if(st.size != 11 || memcmp(buf, "hello World", 11) != 0){
+    printf("%s: wrong file contents\n", s);
+    exit(1);
+  }
+
+  // a full completion queue stops the batch: with two
+  // completions left unread, only IORING_SIZE-2 requests fit.
+  r.cqhead = r.cqtail - 2;
+  for(i = 0; i < IORING_SIZE; i++)
+    ioqueue(&r, IO_CLOSE, 99, 0, 0, 0);
+  if(iosubmit(&r) != IORING_SIZE - 2 || r.sqtail - r.sqhead != 2){
+    printf("%s: iosubmit overran the completion queue\n", s);
+    exit(1);
+  }
+  unlink("ioring");
+}
+
+// lookups must see names come and go, even when the
+// name-lookup cache has already answered them once.
+void
+dcachetest(char *s)
+{
+  int fd;
+  char c;
+
+  unlink("dcd/f");
+  unlink("dcd");
+  if(open("dcd/f", 0) >= 0 || chdir("dcd") == 0){
+    printf("%s: found dcd before it was made\n", s);
+    exit(1);
+  }
+  if(mkdir("dcd") < 0){
+    printf("%s: mkdir dcd failed\n", s);
+    exit(1);
+  }
+  fd = open("dcd/f", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, "a", 1) != 1){
+    printf("%s: create dcd/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(link("dcd/f", "dcd/g") < 0 || unlink("dcd/f") < 0){
+    printf("%s: link/unlink failed\n", s);
+    exit(1);
+  }
+  if(open("dcd/f", 0) >= 0){
+    printf("%s: opened unlinked dcd/f\n", s);
+    exit(1);
+  }
+  fd = open("dcd/g", 0);
+  if(fd < 0 || read(fd, &c, 1) != 1 || c != 'a'){
+    printf("%s: dcd/g is wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("dcd/g") < 0 || unlink("dcd") < 0){
+    printf("%s: unlink dcd failed\n", s);
+    exit(1);
+  }
+
+  // a new dcd, maybe with the old one's inode, starts empty.
+  if(mkdir("dcd") < 0){
+    printf("%s: second mkdir dcd failed\n", s);
+    exit(1);
+  }
+  if(open("dcd/g", 0) >= 0){
+    printf("%s: new dcd has an old name\n", s);
+    exit(1);
+  }
+  if(unlink("dcd") < 0){
+    printf("%s: unlink new dcd failed\n", s);
+    exit(1);
+  }
+}
+
+// a directory big enough to split into several hashed
+// leaves still finds every name, and still reads as a
+// plain array of dirents.
+void
+dirhash(char *s)
+{
+  enum { N = 200 };
+  char name[DIRSIZ];
+  struct dirent de, ents[16];
+  int fd, i, n, got;
+
+  unlink("dh/f");
+  if(mkdir("dh") < 0 || (fd = open("dh/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: mkdir/create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  name[0] = 'd';
+  name[1] = 'h';
+  name[2] = '/';
+  name[6] = '\0';
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if(link("dh/f", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if((fd = open(name, 0)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  if((fd = open("dh", 0)) < 0){
+    printf("%s: open dh failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum)
+      n++;
+  if(n != N + 3){
+    printf("%s: dh has %d entries, not %d\n", s, n, N + 3);
+    exit(1);
+  }
+  close(fd);
+
+  // getdents() returns just the entries in use, a batch at a time.
+  if((fd = open("dh", 0)) < 0){
+    printf("%s: open dh failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  while((got = getdents(fd, ents, 16)) > 0){
+    for(i = 0; i < got; i++)
+      if(ents[i].inum == 0){
+        printf("%s: getdents returned a free entry\n", s);
+        exit(1);
+      }
+    n += got;
+  }
+  close(fd);
+  if(got < 0 || n != N + 3){
+    printf("%s: getdents found too few or too many entries\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("dh") == 0){
+    printf("%s: removed non-empty dh\n", s);
+    exit(1);
+  }
+  if(unlink("dh/f") < 0 || unlink("dh") < 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -1898,59 +2480,293 @@ dirfile(char *s)
     printf("%s: link to dirfile/xx succeeded!\n", s);
     exit(1);
   }
-  if(unlink("dirfile") != 0){
-    printf("%s: unlink dirfile failed!\n", s);
+  if(unlink("dirfile") != 0){
+    printf("%s: unlink dirfile failed!\n", s);
+    exit(1);
+  }
+
+  fd = open(".", O_RDWR);
+  if(fd >= 0){
+    printf("%s: open . for writing succeeded!\n", s);
+    exit(1);
+  }
+  fd = open(".", 0);
+  if(write(fd, "x", 1) > 0){
+    printf("%s: write . succeeded!\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// test that iput() is called at the end of _namei().
+// also tests empty file names.
+void
+iref(char *s)
+{
+  int i, fd;
+
+  for(i = 0; i < NINODE + 1; i++){
+    if(mkdir("irefd") != 0){
+      printf("%s: mkdir irefd failed\n", s);
+      exit(1);
+    }
+    if(chdir("irefd") != 0){
+      printf("%s: chdir irefd failed\n", s);
+      exit(1);
+    }
+
+    mkdir("");
+    link("README", "");
+    fd = open("", O_CREATE);
+    if(fd >= 0)
+      close(fd);
+    fd = open("xx", O_CREATE);
+    if(fd >= 0)
+      close(fd);
+    unlink("xx");
+  }
+
+  // clean up
+  for(i = 0; i < NINODE + 1; i++){
+    chdir("..");
+    unlink("irefd");
+  }
+
+  chdir("/");
+}
+
+// hold more inodes at once than the inode table starts with.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 6, PER = 12 };
+  char name[8];
+  int c, i, fd, pid, ready[2], go[2];
+
+  if(NCHILD * PER <= NINODE){
+    printf("%s: too few inodes to test\n", s);
+    exit(1);
+  }
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  name[0] = 'm';
+  name[1] = 'i';
+  name[4] = '\0';
+  for(c = 0; c < NCHILD; c++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      for(i = 0; i < PER; i++){
+        name[2] = 'a' + c;
+        name[3] = 'a' + i;
+        if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+          printf("%s: create %s failed\n", s, name);
+          write(ready[1], "f", 1);
+          exit(1);
+        }
+        unlink(name);   // the open fd still holds the inode
+      }
+      write(ready[1], "x", 1);
+      read(go[0], &c, 1);   // keep the files open until told
+      exit(0);
+    }
+  }
+  close(go[0]);
+  for(c = 0; c < NCHILD; c++){
+    if(read(ready[0], name, 1) != 1 || name[0] != 'x'){
+      printf("%s: a child failed\n", s);
+      exit(1);
+    }
+  }
+  close(go[1]);
+  close(ready[0]);
+  close(ready[1]);
+  for(c = 0; c < NCHILD; c++){
+    wait(&i);
+    if(i != 0)
+      exit(1);
+  }
+}
+
+// a process can hold more open files than the file and fd
+// tables start with; the lowest free fd is always used.
+void
+manyfds(char *s)
+{
+  enum { NOPEN = 200, NDUP = 600 };
+  int fd, i, pid, xstatus;
+  char c;
+
+  for(i = 3; i < NOPEN; i++){
+    if((fd = open("README", 0)) != i){
+      printf("%s: open returned %d, not %d\n", s, fd, i);
+      exit(1);
+    }
+  }
+  for(; i < NDUP; i++){
+    if((fd = dup(3)) != i){
+      printf("%s: dup returned %d, not %d\n", s, fd, i);
+      exit(1);
+    }
+  }
+  close(100);
+  close(NDUP - 1);
+  if((fd = dup(3)) != 100){
+    printf("%s: dup returned %d, not the lowest free fd\n", s, fd);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(read(NOPEN - 1, &c, 1) != 1 || read(NDUP - 2, &c, 1) != 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child could not read its inherited fds\n", s);
     exit(1);
   }
 
-  fd = open(".", O_RDWR);
-  if(fd >= 0){
-    printf("%s: open . for writing succeeded!\n", s);
-    exit(1);
-  }
-  fd = open(".", 0);
-  if(write(fd, "x", 1) > 0){
-    printf("%s: write . succeeded!\n", s);
+  for(i = 3; i < NDUP - 1; i++)
+    close(i);
+  if((fd = open("README", 0)) != 3){
+    printf("%s: fds not freed\n", s);
     exit(1);
   }
   close(fd);
 }
 
-// test that iput() is called at the end of _namei().
-// also tests empty file names.
+// more children than fit in one page of the process table,
+// each killed by pid and reaped by wait().
 void
-iref(char *s)
+manyprocs(char *s)
 {
-  int i, fd;
+  enum { N = 100 };
+  int pids[N], i, j, pid, last, xstatus;
 
-  for(i = 0; i < NINODE + 1; i++){
-    if(mkdir("irefd") != 0){
-      printf("%s: mkdir irefd failed\n", s);
+  for(i = 0; i < N; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      for(j = 0; j < i; j++)
+        kill(pids[j]);
       exit(1);
     }
-    if(chdir("irefd") != 0){
-      printf("%s: chdir irefd failed\n", s);
+    if(pids[i] == 0){
+      for(;;)
+        sleep(10);
+    }
+  }
+  for(i = N - 1; i >= 0; i--){
+    if(kill(pids[i]) < 0){
+      printf("%s: kill %d failed\n", s, pids[i]);
       exit(1);
     }
+  }
+  last = pids[N - 1];
+  for(i = 0; i < N; i++){
+    if((pid = wait(&xstatus)) < 0){
+      printf("%s: wait failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < N && pids[j] != pid; j++)
+      ;
+    if(j == N || xstatus != -1){
+      printf("%s: wait returned %d status %d\n", s, pid, xstatus);
+      exit(1);
+    }
+    pids[j] = 0;
+  }
+  if(wait(0) != -1){
+    printf("%s: wait found an extra child\n", s);
+    exit(1);
+  }
+  if(kill(last) != -1){
+    printf("%s: killed a process that is gone\n", s);
+    exit(1);
+  }
+}
 
-    mkdir("");
-    link("README", "");
-    fd = open("", O_CREATE);
-    if(fd >= 0)
-      close(fd);
-    fd = open("xx", O_CREATE);
-    if(fd >= 0)
-      close(fd);
-    unlink("xx");
+// readers of one file at once, some through their own
+// opens and some sharing an fd, whose offset they must
+// advance without losing or repeating bytes.
+void
+sharedread(char *s)
+{
+  enum { SZ = 4096, NPRIV = 4, NSHARE = 2 };
+  int fd, i, j, n, tot, xstatus;
+  char b[128];
+
+  unlink("sharedread");
+  if((fd = open("sharedread", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i += sizeof(b)){
+    for(j = 0; j < sizeof(b); j++)
+      b[j] = (i + j) % 251;
+    if(write(fd, b, sizeof(b)) != sizeof(b)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
   }
+  close(fd);
 
-  // clean up
-  for(i = 0; i < NINODE + 1; i++){
-    chdir("..");
-    unlink("irefd");
+  for(i = 0; i < NPRIV; i++){
+    if(fork() == 0){
+      for(j = 0; j < 10; j++){
+        if((fd = open("sharedread", 0)) < 0)
+          exit(-1);
+        for(tot = 0; (n = read(fd, b, 100)) > 0; tot += n){
+          for(int k = 0; k < n; k++)
+            if(b[k] != (char)((tot + k) % 251))
+              exit(-1);
+        }
+        close(fd);
+        if(n < 0 || tot != SZ)
+          exit(-1);
+      }
+      exit(0);
+    }
   }
 
-  chdir("/");
+  fd = open("sharedread", 0);
+  for(i = 0; i < NSHARE; i++){
+    if(fork() == 0){
+      for(tot = 0; read(fd, b, 1) == 1; tot++)
+        ;
+      exit(tot);
+    }
+  }
+  close(fd);
+
+  tot = 0;
+  for(i = 0; i < NPRIV + NSHARE; i++){
+    wait(&xstatus);
+    if(xstatus < 0){
+      printf("%s: a reader failed\n", s);
+      exit(1);
+    }
+    tot += xstatus;
+  }
+  // the private readers exit 0; the shared ones, with
+  // what they read between them.
+  if(tot != SZ){
+    printf("%s: shared fd readers read %d, not %d\n", s, tot, SZ);
+    exit(1);
+  }
+  unlink("sharedread");
 }
 
 // test that fork fails gracefully
@@ -2117,6 +2933,67 @@ sbrkmuch(char *s)
   }
 }
 
+// grow by a few megabytes from a 2-megabyte boundary, so that the
+// kernel can use megapages, then check that fork() copies them and
+// that shrinking to the middle of one keeps the rest intact.
+void
+sbrkmega(char *s)
+{
+  enum { MEGA=2*1024*1024 };
+  char *a, *oldbrk;
+  uint64 top;
+  int xstatus;
+
+  oldbrk = sbrk(0);
+  top = ((uint64)oldbrk + MEGA - 1) & ~(uint64)(MEGA - 1);
+  if(sbrk(top - (uint64)oldbrk + 2*MEGA) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)top;
+  for(int i = 0; i < 2*MEGA; i += PGSIZE)
+    a[i] = i / PGSIZE;
+
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < 2*MEGA; i += PGSIZE){
+      if(a[i] != (char)(i / PGSIZE)){
+        printf("%s: child sees wrong data at %d\n", s, i);
+        exit(1);
+      }
+      a[i] = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // cut the second megapage in half.
+  if(sbrk(-(MEGA/2 + PGSIZE)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 2*MEGA - (MEGA/2 + PGSIZE); i += PGSIZE){
+    if(a[i] != (char)(i / PGSIZE)){
+      printf("%s: wrong data at %d after shrink\n", s, i);
+      exit(1);
+    }
+  }
+
+  // regrow; the new memory must be zero.
+  char *b = sbrk(PGSIZE);
+  if(b == (char*)-1 || *b != 0){
+    printf("%s: regrow failed\n", s);
+    exit(1);
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2421,6 +3298,40 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// check that system calls can't read or write the
+// stack guard page either.
+void
+stackguard(char *s)
+{
+  char *guard = (char *) (PGROUNDDOWN(r_sp()) - PGSIZE);
+  int fd, fds[2];
+
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if(read(fd, guard, 10) != -1 || read(fd, guard + PGSIZE - 5, 10) != -1){
+    printf("%s: read into the stack guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], guard, 10) != -1){
+    printf("%s: write from the stack guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(open(guard, O_RDONLY) != -1){
+    printf("%s: open of a name in the stack guard page succeeded\n", s);
+    exit(1);
+  }
+}
+
 // check that writes to text segment fault
 void
 textwrite(char *s)
@@ -2444,6 +3355,32 @@ textwrite(char *s)
     exit(xstatus);
 }
 
+// the kernel must not write into read-only user text
+// on a process's behalf either.
+void
+textcopyout(char *s)
+{
+  char *text = (char*)textwrite;
+  char before[8];
+
+  memmove(before, text, sizeof(before));
+  int fd = open("README", 0);
+  if(fd < 0){
+    printf("%s: open(README) failed\n", s);
+    exit(1);
+  }
+  int n = read(fd, text, sizeof(before));
+  close(fd);
+  if(n > 0){
+    printf("%s: read into text returned %d\n", s, n);
+    exit(1);
+  }
+  if(memcmp(before, text, sizeof(before)) != 0){
+    printf("%s: text was modified\n", s);
+    exit(1);
+  }
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2571,6 +3508,274 @@ badarg(char *s)
   exit(0);
 }
 
+// pin a process to one CPU, check that the mask sticks,
+// is inherited by fork, and that bad masks and pids are refused.
+void
+affinity(char *s)
+{
+  int all, pid, xstatus;
+
+  all = getaffinity(0);
+  if(all <= 0){
+    printf("%s: getaffinity(0) returned %d\n", s, all);
+    exit(1);
+  }
+  if(setaffinity(0, 0) != -1){
+    printf("%s: setaffinity with empty mask succeeded\n", s);
+    exit(1);
+  }
+  if(setaffinity(-1, all) != -1 || getaffinity(-1) != -1){
+    printf("%s: affinity of pid -1 succeeded\n", s);
+    exit(1);
+  }
+  if(setaffinity(0, 1) != 0 || getaffinity(0) != 1){
+    printf("%s: could not pin to cpu 0\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < 100; i++)
+      getpid();
+    exit(getaffinity(0) == 1 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit affinity\n", s);
+    exit(1);
+  }
+
+  if(setaffinity(getpid(), all) != 0 || getaffinity(0) != all){
+    printf("%s: could not restore affinity\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// lockstat() should know the proc locks, and count
+// acquisitions of them made by fork() and wait().
+void
+lockstats(char *s)
+{
+  static struct lockstat ls[NLOCKCLASS];
+  uint64 before, after;
+  int i, n, was;
+
+  if(lockstat(ls, -1) != -1){
+    printf("%s: lockstat with n = -1 succeeded\n", s);
+    exit(1);
+  }
+  if(lockstat((struct lockstat*)0xffffffffffffULL, NLOCKCLASS) != -1){
+    printf("%s: lockstat to a bad address succeeded\n", s);
+    exit(1);
+  }
+  n = lockstat(ls, NLOCKCLASS);
+  for(i = 0; i < n; i++)
+    if(strcmp(ls[i].name, "proc") == 0 && ls[i].sleep == 0)
+      break;
+  if(i >= n){
+    printf("%s: no proc lock class\n", s);
+    exit(1);
+  }
+  was = lockcount(1);
+  before = ls[i].acquires;
+  if(fork() == 0)
+    exit(0);
+  wait(0);
+  lockcount(0);
+  if(lockstat(ls, NLOCKCLASS) < n || ls[i].acquires <= before){
+    printf("%s: proc lock acquisitions not counted\n", s);
+    exit(1);
+  }
+
+  // nothing is counted while counting is off.
+  after = ls[i].acquires;
+  if(fork() == 0)
+    exit(0);
+  wait(0);
+  lockstat(ls, NLOCKCLASS);
+  lockcount(was);
+  if(!was && ls[i].acquires != after){
+    printf("%s: proc lock acquisitions counted while off\n", s);
+    exit(1);
+  }
+}
+
+// the profiler should sample us while we spin in user space,
+// and profread() should see the end once it's turned off.
+void
+profiling(char *s)
+{
+  static struct profsample ps[64];
+  int i, n, t0, mine = 0;
+
+  profile(1);
+  t0 = uptime();
+  while(uptime() - t0 < 3)
+    ;
+  profile(0);
+  while((n = profread(ps, 64)) > 0){
+    for(i = 0; i < n; i++)
+      if(ps[i].pid == getpid() && ps[i].user)
+        mine++;
+  }
+  if(n < 0){
+    printf("%s: profread failed\n", s);
+    exit(1);
+  }
+  if(mine == 0){
+    printf("%s: no samples of our own\n", s);
+    exit(1);
+  }
+  if(profread(ps, 64) != 0){
+    printf("%s: samples after profiling stopped\n", s);
+    exit(1);
+  }
+}
+
+// the trace device should record our system calls
+// while it's on, and refuse to be told anything odd.
+void
+tracing(char *s)
+{
+  static struct traceevent ev[64];
+  int fd, i, n, pid, found = 0;
+
+  if((fd = open("/trace", O_RDWR)) < 0){
+    printf("%s: cannot open /trace\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != -1){
+    printf("%s: trace device took x\n", s);
+    exit(1);
+  }
+  if(write(fd, "1", 1) != 1){
+    printf("%s: cannot start tracing\n", s);
+    exit(1);
+  }
+  pid = getpid();
+  write(fd, "0", 1);
+  while((n = read(fd, ev, sizeof(ev))) > 0){
+    for(i = 0; i < n / sizeof(ev[0]); i++)
+      if(ev[i].type == TR_SYSCALL && ev[i].a == SYS_getpid && ev[i].pid == pid)
+        found = 1;
+  }
+  close(fd);
+  if(n < 0 || !found){
+    printf("%s: getpid() not traced\n", s);
+    exit(1);
+  }
+}
+
+// find our own struct pstat.
+static struct pstat*
+mypstat(char *s, struct pstat *ps, int max)
+{
+  int i, n;
+
+  n = procstat(ps, max);
+  for(i = 0; i < n; i++)
+    if(ps[i].pid == getpid())
+      return &ps[i];
+  printf("%s: procstat didn't list us\n", s);
+  exit(1);
+}
+
+// procstat() should count our system calls, time,
+// and waits, as we make them.
+void
+pstats(char *s)
+{
+  static struct pstat ps[64];
+  struct pstat *me, before;
+  int i, t0;
+
+  if(procstat(ps, -1) != -1){
+    printf("%s: procstat with n = -1 succeeded\n", s);
+    exit(1);
+  }
+  before = *mypstat(s, ps, 64);
+  for(i = 0; i < 20; i++)
+    getpid();
+  t0 = uptime();
+  while(uptime() - t0 < 2)
+    ;
+  sleep(1);
+  me = mypstat(s, ps, 64);
+  if(me->syscalls < before.syscalls + 20){
+    printf("%s: %d system calls counted, not 20\n", s,
+           (int)(me->syscalls - before.syscalls));
+    exit(1);
+  }
+  if(me->utime <= before.utime || me->stime <= before.stime){
+    printf("%s: time not counted\n", s);
+    exit(1);
+  }
+  if(me->vcsw <= before.vcsw){
+    printf("%s: sleep not counted\n", s);
+    exit(1);
+  }
+  if(strcmp(me->state, "run") != 0 || me->sz == 0){
+    printf("%s: state %s, size %d\n", s, me->state, (int)me->sz);
+    exit(1);
+  }
+}
+
+// system call counts and latencies.
+void
+sysstats(char *s)
+{
+  static struct sysstat st0[SYS_sysstat+1], st1[SYS_sysstat+1];
+  struct sysstat *g;
+  uint64 n;
+  int i, was;
+
+  if(sysstat(st0, -1) != -1){
+    printf("%s: sysstat with n = -1 succeeded\n", s);
+    exit(1);
+  }
+  was = syscount(1);
+  if(sysstat(st0, SYS_sysstat+1) != SYS_sysstat+1){
+    printf("%s: sysstat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 100; i++)
+    getpid();
+  sleep(2);
+  syscount(0);
+  for(i = 0; i < 100; i++)
+    getpid();
+  sysstat(st1, SYS_sysstat+1);
+  syscount(was);
+
+  g = &st1[SYS_getpid];
+  if(g->count - st0[SYS_getpid].count < 100){
+    printf("%s: %d getpid calls counted, not 100\n", s,
+           (int)(g->count - st0[SYS_getpid].count));
+    exit(1);
+  }
+  n = 0;
+  for(i = 0; i < NSYSHIST; i++)
+    n += g->hist[i] - st0[SYS_getpid].hist[i];
+  if(n < 100){
+    printf("%s: %d getpid calls in histogram, not 100\n", s, (int)n);
+    exit(1);
+  }
+  if(g->count - st0[SYS_getpid].count >= 200){
+    printf("%s: getpid counted while counting was off\n", s);
+    exit(1);
+  }
+  if(st1[SYS_sleep].count == st0[SYS_sleep].count ||
+     st1[SYS_sleep].max < TICKCYCLES){
+    printf("%s: sleep(2) not counted, or took < 1 tick\n", s);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2594,6 +3799,15 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipeloan, "pipeloan"},
+  {pipeloanread, "pipeloanread"},
+  {splicetest, "splicetest"},
+  {splicebig, "splicebig"},
+  {spliceshared, "spliceshared"},
+  {vectorio, "vectorio"},
+  {ioringtest, "ioringtest"},
+  {dcachetest, "dcachetest"},
+  {dirhash, "dirhash"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2617,9 +3831,14 @@ struct test {
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
   {iref, "iref"},
+  {manyinodes, "manyinodes"},
+  {manyfds, "manyfds"},
+  {manyprocs, "manyprocs"},
+  {sharedread, "sharedread"},
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {sbrkmega, "sbrkmega"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
@@ -2629,12 +3848,20 @@ struct test {
   {bigargtest, "bigargtest"},
   {argptest, "argptest"},
   {stacktest, "stacktest"},
+  {stackguard, "stackguard"},
   {textwrite, "textwrite"},
+  {textcopyout, "textcopyout"},
   {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {affinity, "affinity" },
+  {lockstats, "lockstats" },
+  {profiling, "profiling" },
+  {tracing, "tracing" },
+  {pstats, "pstats" },
+  {sysstats, "sysstats" },
 
   { 0, 0},
 };
@@ -36,3 +36,20 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("setaffinity");
+entry("getaffinity");
+entry("splice");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("iosubmit");
+entry("getdents");
+entry("lockbench");
+entry("lockstat");
+entry("profile");
+entry("profread");
+entry("procstat");
+entry("syscount");
+entry("sysstat");
+entry("lockcount");